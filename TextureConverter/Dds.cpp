@@ -0,0 +1,242 @@
+#include "Dds.h"
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	const uint32_t ddsMagic = 0x20534444;	//"DDS "
+	const uint32_t headerSize = 124;
+	const uint32_t fourCCFlag = 0x4;
+
+	uint32_t fourCC(const char* code)
+	{
+		return code[0] | (code[1] << 8) | (code[2] << 16) | (code[3] << 24);
+	}
+
+	uint32_t readUint32(const unsigned char* data)
+	{
+		return data[0] | (data[1] << 8) | (data[2] << 16) | (uint32_t(data[3]) << 24);
+	}
+
+	void writeUint32(unsigned char* data, uint32_t value)
+	{
+		data[0] = value & 0xff;
+		data[1] = (value >> 8) & 0xff;
+		data[2] = (value >> 16) & 0xff;
+		data[3] = (value >> 24) & 0xff;
+	}
+
+	void decodeColor565(uint16_t color, unsigned char* rgb)
+	{
+		rgb[0] = static_cast<unsigned char>(((color >> 11) & 0x1f) * 255 / 31);
+		rgb[1] = static_cast<unsigned char>(((color >> 5) & 0x3f) * 255 / 63);
+		rgb[2] = static_cast<unsigned char>((color & 0x1f) * 255 / 31);
+	}
+
+	// Writes 16 rgba pixels, alpha is only touched by the three color mode of BC1
+	void decodeColorBlock(const unsigned char* block, unsigned char* pixels, bool allowTransparent)
+	{
+		uint16_t c0 = block[0] | (block[1] << 8);
+		uint16_t c1 = block[2] | (block[3] << 8);
+		unsigned char palette[4][4];
+		decodeColor565(c0, palette[0]);
+		decodeColor565(c1, palette[1]);
+		for (int i = 0; i < 4; ++i) {
+			palette[i][3] = 255;
+		}
+		for (int channel = 0; channel < 3; ++channel) {
+			if (c0 > c1 || !allowTransparent) {
+				palette[2][channel] = static_cast<unsigned char>((2 * palette[0][channel] + palette[1][channel]) / 3);
+				palette[3][channel] = static_cast<unsigned char>((palette[0][channel] + 2 * palette[1][channel]) / 3);
+			}
+			else {
+				palette[2][channel] = static_cast<unsigned char>((palette[0][channel] + palette[1][channel]) / 2);
+				palette[3][channel] = 0;
+			}
+		}
+		if (c0 <= c1 && allowTransparent)
+			palette[3][3] = 0;
+
+		uint32_t indices = readUint32(block + 4);
+		for (int i = 0; i < 16; ++i) {
+			memcpy(pixels + i * 4, palette[(indices >> (2 * i)) & 3], 4);
+		}
+	}
+
+	void decodeExplicitAlpha(const unsigned char* block, unsigned char* pixels)
+	{
+		for (int i = 0; i < 16; ++i) {
+			unsigned char alpha = (block[i / 2] >> ((i % 2) * 4)) & 0xf;
+			pixels[i * 4 + 3] = alpha * 17;
+		}
+	}
+
+	void decodeInterpolatedAlpha(const unsigned char* block, unsigned char* pixels)
+	{
+		unsigned char palette[8];
+		palette[0] = block[0];
+		palette[1] = block[1];
+		if (palette[0] > palette[1]) {
+			for (int i = 1; i < 7; ++i) {
+				palette[i + 1] = static_cast<unsigned char>(((7 - i) * palette[0] + i * palette[1]) / 7);
+			}
+		}
+		else {
+			for (int i = 1; i < 5; ++i) {
+				palette[i + 1] = static_cast<unsigned char>(((5 - i) * palette[0] + i * palette[1]) / 5);
+			}
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+
+		uint64_t indices = 0;
+		for (int i = 0; i < 6; ++i) {
+			indices |= uint64_t(block[2 + i]) << (8 * i);
+		}
+		for (int i = 0; i < 16; ++i) {
+			pixels[i * 4 + 3] = palette[(indices >> (3 * i)) & 7];
+		}
+	}
+}
+
+DdsImage::DdsImage(Format format, int width, int height)
+	:format(format), width(width), height(height)
+{
+	blocks.assign(blockSize() * blocksWide() * blocksHigh(), 0);
+}
+
+void DdsImage::copyBlocks(const DdsImage& src, int x, int y)
+{
+	if (src.format != format)
+		throw std::runtime_error("Block formats do not match");
+	if (x % 4 || y % 4 || src.width % 4 || src.height % 4)
+		throw std::runtime_error("Block copy is not aligned to 4 pixels");
+	if (x < 0 || y < 0 || src.width + x > width || src.height + y > height)
+		throw std::runtime_error("Image writing exceeds Bounds");
+
+	size_t rowSize = src.blocksWide() * blockSize();
+	for (int row = 0; row < src.height / 4; ++row) {
+		memcpy(blocks.data() + ((y / 4 + row) * blocksWide() + x / 4) * blockSize(), src.blocks.data() + row * rowSize, rowSize);
+	}
+}
+
+std::vector<unsigned char> DdsImage::decode() const
+{
+	std::vector<unsigned char> result(width * height * 4);
+	unsigned char pixels[16 * 4];
+	for (int blockY = 0; blockY < blocksHigh(); ++blockY) {
+		for (int blockX = 0; blockX < blocksWide(); ++blockX) {
+			const unsigned char* block = blocks.data() + (blockY * blocksWide() + blockX) * blockSize();
+			switch (format) {
+			case BC1:
+				decodeColorBlock(block, pixels, true);
+				break;
+			case BC2:
+				decodeColorBlock(block + 8, pixels, false);
+				decodeExplicitAlpha(block, pixels);
+				break;
+			case BC3:
+				decodeColorBlock(block + 8, pixels, false);
+				decodeInterpolatedAlpha(block, pixels);
+				break;
+			}
+
+			for (int py = 0; py < 4 && blockY * 4 + py < height; ++py) {
+				int pixelCount = std::min(4, width - blockX * 4);
+				memcpy(result.data() + ((blockY * 4 + py) * width + blockX * 4) * 4, pixels + py * 16, pixelCount * 4);
+			}
+		}
+	}
+	return result;
+}
+
+bool isDdsFile(const std::string& filename)
+{
+	std::ifstream file{ filename, std::ifstream::in | std::ifstream::binary };
+	unsigned char magic[4];
+	return file.read(reinterpret_cast<char*>(magic), 4) && readUint32(magic) == ddsMagic;
+}
+
+DdsImage readDds(const std::string& filename)
+{
+	std::ifstream file{ filename, std::ifstream::in | std::ifstream::binary };
+	unsigned char header[4 + headerSize];
+	if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || readUint32(header) != ddsMagic)
+		throw std::runtime_error("Not a DDS file " + filename);
+
+	const unsigned char* pixelFormat = header + 4 + 72;
+	uint32_t code = readUint32(pixelFormat + 8);
+	if (!(readUint32(pixelFormat + 4) & fourCCFlag))
+		throw std::runtime_error("Uncompressed DDS files are not supported");
+
+	DdsImage::Format format;
+	if (code == fourCC("DXT1"))
+		format = DdsImage::BC1;
+	else if (code == fourCC("DXT2") || code == fourCC("DXT3"))
+		format = DdsImage::BC2;
+	else if (code == fourCC("DXT4") || code == fourCC("DXT5"))
+		format = DdsImage::BC3;
+	else
+		throw std::runtime_error("Unsupported DDS format in " + filename);
+
+	DdsImage image{ format, static_cast<int>(readUint32(header + 4 + 12)), static_cast<int>(readUint32(header + 4 + 8)) };
+	if (!file.read(reinterpret_cast<char*>(image.blocks.data()), image.blocks.size()))
+		throw std::runtime_error("Unexpected end of DDS file " + filename);
+	return image;
+}
+
+void writeDds(const std::string& filename, const DdsImage& image)
+{
+	unsigned char header[4 + headerSize] = {};
+	writeUint32(header, ddsMagic);
+	unsigned char* ddsHeader = header + 4;
+	writeUint32(ddsHeader, headerSize);
+	writeUint32(ddsHeader + 4, 0x1 | 0x2 | 0x4 | 0x1000 | 0x80000);	//caps, height, width, pixelformat, linearsize
+	writeUint32(ddsHeader + 8, image.height);
+	writeUint32(ddsHeader + 12, image.width);
+	writeUint32(ddsHeader + 16, static_cast<uint32_t>(image.blocks.size()));
+	unsigned char* pixelFormat = ddsHeader + 72;
+	writeUint32(pixelFormat, 32);
+	writeUint32(pixelFormat + 4, fourCCFlag);
+	const char* codes[] = { "DXT1", "DXT3", "DXT5" };
+	writeUint32(pixelFormat + 8, fourCC(codes[image.format]));
+	writeUint32(ddsHeader + 104, 0x1000);	//texture
+
+	std::ofstream file{ filename, std::ofstream::out | std::ofstream::binary };
+	if (!file.good())
+		throw std::runtime_error("Can not write to output file " + filename);
+	file.write(reinterpret_cast<const char*>(header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(image.blocks.data()), image.blocks.size());
+}
+
+void writeRgbaDds(const std::string& filename, int width, int height, const std::vector<const unsigned char*>& levels)
+{
+	unsigned char header[4 + headerSize] = {};
+	writeUint32(header, ddsMagic);
+	unsigned char* ddsHeader = header + 4;
+	writeUint32(ddsHeader, headerSize);
+	writeUint32(ddsHeader + 4, 0x1 | 0x2 | 0x4 | 0x8 | 0x1000 | 0x20000);	//caps, height, width, pitch, pixelformat, mipmapcount
+	writeUint32(ddsHeader + 8, height);
+	writeUint32(ddsHeader + 12, width);
+	writeUint32(ddsHeader + 16, width * 4);
+	writeUint32(ddsHeader + 24, static_cast<uint32_t>(levels.size()));
+	unsigned char* pixelFormat = ddsHeader + 72;
+	writeUint32(pixelFormat, 32);
+	writeUint32(pixelFormat + 4, 0x1 | 0x40);	//alphapixels, rgb
+	writeUint32(pixelFormat + 12, 32);
+	writeUint32(pixelFormat + 16, 0x000000ff);
+	writeUint32(pixelFormat + 20, 0x0000ff00);
+	writeUint32(pixelFormat + 24, 0x00ff0000);
+	writeUint32(pixelFormat + 28, 0xff000000);
+	writeUint32(ddsHeader + 104, levels.size() > 1 ? 0x1000 | 0x8 | 0x400000 : 0x1000);	//texture, complex, mipmap
+
+	std::ofstream file{ filename, std::ofstream::out | std::ofstream::binary };
+	if (!file.good())
+		throw std::runtime_error("Can not write to output file " + filename);
+	file.write(reinterpret_cast<const char*>(header), sizeof(header));
+	for (size_t i = 0; i < levels.size(); ++i) {
+		size_t levelSize = size_t(std::max(1, width >> i)) * std::max(1, height >> i) * 4;
+		file.write(reinterpret_cast<const char*>(levels[i]), levelSize);
+	}
+}
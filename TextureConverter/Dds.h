@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// Block compressed (DXT1/3/5) DDS textures, only the top mip level is used
+struct DdsImage {
+	enum Format { BC1, BC2, BC3 };
+	Format format;
+	int width;
+	int height;
+	std::vector<unsigned char> blocks;	//rows of 4x4 pixel blocks
+
+	DdsImage() = default;
+	DdsImage(Format format, int width, int height);
+
+	size_t blockSize() const { return format == BC1 ? 8 : 16; }
+	int blocksWide() const { return std::max(1, (width + 3) / 4); }
+	int blocksHigh() const { return std::max(1, (height + 3) / 4); }
+
+	// Copies the blocks of src to the pixel offset x, y. Offsets and the size of src must be multiples of 4
+	void copyBlocks(const DdsImage& src, int x, int y);
+	// Decodes to 4 channel rgba
+	std::vector<unsigned char> decode() const;
+};
+
+bool isDdsFile(const std::string& filename);
+DdsImage readDds(const std::string& filename);
+void writeDds(const std::string& filename, const DdsImage& image);
+// Uncompressed rgba DDS, levels holds the base image followed by its mip levels
+void writeRgbaDds(const std::string& filename, int width, int height, const std::vector<const unsigned char*>& levels);
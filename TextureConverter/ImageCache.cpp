@@ -0,0 +1,97 @@
+#include "ImageCache.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace {
+	time_t modificationTime(const std::string& filename)
+	{
+		struct stat info;
+		if (stat(filename.c_str(), &info) != 0)
+			return 0;
+		return info.st_mtime;
+	}
+}
+
+ImageCache::ImageCache(size_t budget, Loader loader)
+	:budget(budget), loader(loader)
+{
+}
+
+std::shared_ptr<const Image> ImageCache::load(const std::string& filename)
+{
+	Key key{ filename, modificationTime(filename) };
+	std::promise<std::shared_ptr<const Image>> promise;
+	std::shared_future<std::shared_ptr<const Image>> pending;
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+		auto it = entries.find(key);
+		if (it != entries.end()) {
+			++hitCount;
+			lru.splice(lru.begin(), lru, it->second.lruPosition);
+			if (it->second.image)
+				return it->second.image;
+			pending = it->second.pending;
+		}
+		else {
+			++missCount;
+			lru.push_front(key);
+			Entry& entry = entries[key];
+			entry.pending = promise.get_future().share();
+			entry.lruPosition = lru.begin();
+		}
+	}
+	if (pending.valid())
+		return pending.get();
+
+	std::shared_ptr<const Image> image;
+	try {
+		image = loader(filename);
+	}
+	catch (...) {
+		{
+			std::lock_guard<std::mutex> lock{ mutex };
+			auto it = entries.find(key);
+			lru.erase(it->second.lruPosition);
+			entries.erase(it);
+		}
+		promise.set_exception(std::current_exception());
+		throw;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+		entries[key].image = image;
+		cachedSize += image->size();
+		evict();
+	}
+	promise.set_value(image);
+	return image;
+}
+
+size_t ImageCache::hits() const
+{
+	std::lock_guard<std::mutex> lock{ mutex };
+	return hitCount;
+}
+
+size_t ImageCache::misses() const
+{
+	std::lock_guard<std::mutex> lock{ mutex };
+	return missCount;
+}
+
+void ImageCache::evict()
+{
+	//Images still in use by a worker stay alive through their shared_ptr
+	auto it = lru.end();
+	while (cachedSize > budget && it != lru.begin()) {
+		--it;
+		auto entry = entries.find(*it);
+		if (!entry->second.image)
+			continue;	//still loading
+
+		cachedSize -= entry->second.image->size();
+		entries.erase(entry);
+		it = lru.erase(it);
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <map>
+#include <list>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <ctime>
+
+typedef std::unique_ptr<unsigned char, void(*)(void*)> ImageData;
+
+struct Image {
+	ImageData data;
+	int width;
+	int height;
+	int channels;
+
+	size_t size() const { return static_cast<size_t>(width) * height * channels; }
+};
+
+// Thread safe LRU cache of decoded images, keyed by filename and modification time
+class ImageCache
+{
+public:
+	typedef std::function<std::shared_ptr<const Image>(const std::string&)> Loader;
+
+	ImageCache(size_t budget, Loader loader);
+
+	// Returns the cached image or decodes it. Concurrent requests for the same image wait for a single decode
+	std::shared_ptr<const Image> load(const std::string& filename);
+
+	size_t hits() const;
+	size_t misses() const;
+
+private:
+	typedef std::pair<std::string, time_t> Key;
+	struct Entry {
+		std::shared_future<std::shared_ptr<const Image>> pending;
+		std::shared_ptr<const Image> image;	//null while loading
+		std::list<Key>::iterator lruPosition;
+	};
+
+	void evict();
+
+	size_t budget;
+	Loader loader;
+	mutable std::mutex mutex;
+	std::map<Key, Entry> entries;
+	std::list<Key> lru;		//most recently used first
+	size_t cachedSize = 0;
+	size_t hitCount = 0;
+	size_t missCount = 0;
+};
@@ -0,0 +1,215 @@
+#include "Mipmaps.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(_M_X64) || defined(__SSE2__)
+#define MIPS_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+	const float kaiserAlpha = 4.0f;
+	const float kaiserRadius = 3.0f;	//in destination pixels
+
+	// Averages 2x2 blocks of row0 and row1, odd sizes repeat the last pixel
+	void boxRow(const unsigned char* row0, const unsigned char* row1, unsigned char* dst, int srcWidth, int dstWidth, int channels)
+	{
+		int x = 0;
+#ifdef MIPS_SSE
+		if (channels == 4) {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i rounding = _mm_set1_epi16(2);
+			//Two destination pixels from four source pixels of both rows per iteration
+			for (; x + 2 <= dstWidth && 2 * x + 4 <= srcWidth; x += 2) {
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+				__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+				__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+				__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+				sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 4), _mm_packus_epi16(sum, zero));
+			}
+		}
+#endif
+		for (; x < dstWidth; ++x) {
+			int x0 = std::min(2 * x, srcWidth - 1) * channels;
+			int x1 = std::min(2 * x + 1, srcWidth - 1) * channels;
+			for (int c = 0; c < channels; ++c) {
+				dst[x * channels + c] = static_cast<unsigned char>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+			}
+		}
+	}
+
+	MipLevel boxDownsample(const unsigned char* pixels, int width, int height, int channels)
+	{
+		MipLevel result{ std::max(1, width / 2), std::max(1, height / 2), {} };
+		result.pixels.resize(result.width * result.height * channels);
+		for (int y = 0; y < result.height; ++y) {
+			const unsigned char* row0 = pixels + std::min(2 * y, height - 1) * width * channels;
+			const unsigned char* row1 = pixels + std::min(2 * y + 1, height - 1) * width * channels;
+			boxRow(row0, row1, result.pixels.data() + y * result.width * channels, width, result.width, channels);
+		}
+		return result;
+	}
+
+	float besselI0(float x)
+	{
+		float sum = 1.0f;
+		float term = 1.0f;
+		for (int k = 1; k < 20; ++k) {
+			float factor = x / (2.0f * k);
+			term *= factor * factor;
+			sum += term;
+		}
+		return sum;
+	}
+
+	// Kaiser windowed sinc, x in destination pixels
+	float kaiser(float x)
+	{
+		if (std::abs(x) >= kaiserRadius)
+			return 0.0f;
+		const float pi = 3.14159265f;
+		float sinc = x == 0.0f ? 1.0f : std::sin(pi * x) / (pi * x);
+		float t = x / kaiserRadius;
+		return sinc * besselI0(kaiserAlpha * std::sqrt(1.0f - t * t)) / besselI0(kaiserAlpha);
+	}
+
+	struct Tap {
+		int first;
+		std::vector<float> weights;
+	};
+
+	// Normalized filter taps of every destination pixel, source indices outside the image are clamped when applied
+	std::vector<Tap> kaiserTaps(int srcSize, int dstSize)
+	{
+		float scale = float(srcSize) / dstSize;
+		std::vector<Tap> taps(dstSize);
+		for (int i = 0; i < dstSize; ++i) {
+			float center = (i + 0.5f) * scale;
+			Tap& tap = taps[i];
+			tap.first = static_cast<int>(std::floor(center - kaiserRadius * scale));
+			int last = static_cast<int>(std::ceil(center + kaiserRadius * scale));
+			float sum = 0.0f;
+			for (int s = tap.first; s <= last; ++s) {
+				tap.weights.push_back(kaiser((s + 0.5f - center) / scale));
+				sum += tap.weights.back();
+			}
+			for (float& weight : tap.weights) {
+				weight /= sum;
+			}
+		}
+		return taps;
+	}
+
+	// Horizontal pass of one row, every destination pixel is the weighted sum of its taps
+	void kaiserRow(const unsigned char* src, float* dst, const std::vector<Tap>& taps, int srcWidth, int dstWidth, int channels)
+	{
+		int x = 0;
+#ifdef MIPS_SSE
+		if (channels == 4) {
+			//All four channels of a pixel at once
+			const __m128i zero = _mm_setzero_si128();
+			for (; x < dstWidth; ++x) {
+				const Tap& tap = taps[x];
+				__m128 sum = _mm_setzero_ps();
+				for (size_t i = 0; i < tap.weights.size(); ++i) {
+					int sx = std::min(std::max(tap.first + int(i), 0), srcWidth - 1);
+					int pixel;
+					memcpy(&pixel, src + sx * 4, 4);
+					__m128i values = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero), zero);
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(tap.weights[i]), _mm_cvtepi32_ps(values)));
+				}
+				_mm_storeu_ps(dst + x * 4, sum);
+			}
+		}
+#endif
+		for (; x < dstWidth; ++x) {
+			const Tap& tap = taps[x];
+			for (size_t i = 0; i < tap.weights.size(); ++i) {
+				int sx = std::min(std::max(tap.first + int(i), 0), srcWidth - 1);
+				for (int c = 0; c < channels; ++c) {
+					dst[x * channels + c] += tap.weights[i] * src[sx * channels + c];
+				}
+			}
+		}
+	}
+
+	// column += weight * src over size floats
+	void addWeighted(float* column, const float* src, float weight, int size)
+	{
+		int j = 0;
+#ifdef MIPS_SSE
+		const __m128 factor = _mm_set1_ps(weight);
+		for (; j + 4 <= size; j += 4) {
+			_mm_storeu_ps(column + j, _mm_add_ps(_mm_loadu_ps(column + j), _mm_mul_ps(factor, _mm_loadu_ps(src + j))));
+		}
+#endif
+		for (; j < size; ++j) {
+			column[j] += weight * src[j];
+		}
+	}
+
+	// Rounds and clamps size floats to bytes
+	void storeBytes(const float* values, unsigned char* dst, int size)
+	{
+		int j = 0;
+#ifdef MIPS_SSE
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 low = _mm_setzero_ps();
+		const __m128 high = _mm_set1_ps(255.0f);
+		const __m128i zero = _mm_setzero_si128();
+		for (; j + 4 <= size; j += 4) {
+			__m128 value = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_loadu_ps(values + j), half), low), high);
+			__m128i words = _mm_packs_epi32(_mm_cvttps_epi32(value), zero);
+			int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, zero));
+			memcpy(dst + j, &bytes, 4);
+		}
+#endif
+		for (; j < size; ++j) {
+			dst[j] = static_cast<unsigned char>(std::min(std::max(values[j] + 0.5f, 0.0f), 255.0f));
+		}
+	}
+
+	MipLevel kaiserDownsample(const unsigned char* pixels, int width, int height, int channels)
+	{
+		MipLevel result{ std::max(1, width / 2), std::max(1, height / 2), {} };
+		std::vector<Tap> horizontal = kaiserTaps(width, result.width);
+		std::vector<Tap> vertical = kaiserTaps(height, result.height);
+
+		//Separable: rows into a float buffer, then columns into the result
+		std::vector<float> rows(result.width * height * channels);
+		for (int y = 0; y < height; ++y) {
+			kaiserRow(pixels + y * width * channels, rows.data() + y * result.width * channels, horizontal, width, result.width, channels);
+		}
+
+		int rowSize = result.width * channels;
+		result.pixels.resize(rowSize * result.height);
+		std::vector<float> column(rowSize);
+		for (int y = 0; y < result.height; ++y) {
+			const Tap& tap = vertical[y];
+			std::fill(column.begin(), column.end(), 0.0f);
+			for (size_t i = 0; i < tap.weights.size(); ++i) {
+				int sy = std::min(std::max(tap.first + int(i), 0), height - 1);
+				addWeighted(column.data(), rows.data() + sy * rowSize, tap.weights[i], rowSize);
+			}
+			storeBytes(column.data(), result.pixels.data() + y * rowSize, rowSize);
+		}
+		return result;
+	}
+}
+
+std::vector<MipLevel> generateMips(const unsigned char* pixels, int width, int height, int channels, MipFilter filter)
+{
+	std::vector<MipLevel> levels;
+	while (width > 1 || height > 1) {
+		if (filter == MipFilter::Box)
+			levels.push_back(boxDownsample(pixels, width, height, channels));
+		else
+			levels.push_back(kaiserDownsample(pixels, width, height, channels));
+		pixels = levels.back().pixels.data();
+		width = levels.back().width;
+		height = levels.back().height;
+	}
+	return levels;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <vector>
+
+enum class MipFilter { Box, Kaiser };
+
+struct MipLevel {
+	int width;
+	int height;
+	std::vector<unsigned char> pixels;
+};
+
+// Returns the levels below the base image down to 1x1, each one filtered from the previous level
+std::vector<MipLevel> generateMips(const unsigned char* pixels, int width, int height, int channels, MipFilter filter);
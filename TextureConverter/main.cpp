@@ -1,12 +1,22 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <map>
 #include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <cstring>
 #include <tclap/CmdLine.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
+#include "Dds.h"
+#include "ImageCache.h"
+#include "Mipmaps.h"
 
 struct ConFile {
 	std::string textureFile;
@@ -22,10 +32,29 @@ struct ConFile {
 	void readTextureFilename(std::istream& stream, const std::string& overrideFolder, const std::string& outputFolder);
 	void readOffset(std::istream& stream);
 };
+struct OutputOptions {
+	std::string format;		//tga, png or dds
+	bool mips;
+	MipFilter mipFilter;
+};
+struct Job {
+	std::string name;
+	std::function<void(std::vector<unsigned char>&)> run;
+};
 ConFile parseConFile(std::istream& stream, const std::string& overrideFolder, const std::string& outputFolder);
-void processFile(const ConFile& file);
+ConFile parseConFile(const std::string& filename, const std::string& overrideFolder, const std::string& outputFolder);
+ImageData loadImage(const std::string& filename, int& width, int& height, int& channels);
+ImageData decodeDds(const DdsImage& image, int& width, int& height, int& channels);
+std::string replaceExtension(const std::string& filename, const std::string& extension);
+void processFile(const ConFile& file, const OutputOptions& options, ImageCache& cache, std::vector<unsigned char>& outputBuffer);
+void processAtlas(const std::string& outputFile, const std::vector<ConFile>& items, const OutputOptions& options, ImageCache& cache,
+	std::vector<unsigned char>& outputBuffer);
+void writeImage(const std::string& outputFile, std::vector<unsigned char>& pixels, int width, int height, int channels, const OutputOptions& options);
 void targetSize(ConFile::ItemType type, int& width, int& height);
-void copyImageRegion(const unsigned char* src, unsigned char* dst, int srcWidth, int srcHeight, int dstWidth, int dstHeight, int xOffset, int yOffset, int channels);
+const char* canvasName(ConFile::ItemType type);
+std::string characterName(const std::string& conFilename);
+void copyImageRegion(const unsigned char* src, unsigned char* dst, int srcWidth, int srcHeight, int dstWidth, int dstHeight, int xOffset, int yOffset,
+	int srcChannels, int dstChannels);
 
 int main(int argc, char** argv)
 {
@@ -34,22 +63,88 @@ int main(int argc, char** argv)
 		TCLAP::UnlabeledMultiArg<std::string> inputArgs{ "input", "Input files .con", true, "filename", cmd };
 		TCLAP::ValueArg<std::string> textureFolderArg{ "t", "textureOverride", "Folder where the texture is stored", true, "", "folder", cmd };
 		TCLAP::ValueArg<std::string> outputFolder{ "o", "output", "output Folder", false, ".", "folder", cmd };
+		TCLAP::ValueArg<unsigned> jobsArg{ "j", "jobs", "Number of files processed in parallel", false, 1, "count", cmd };
+		TCLAP::SwitchArg atlasArg{ "a", "atlas", "Compose all items of a character that share a texture into one atlas", cmd };
+		TCLAP::ValueArg<unsigned> cacheArg{ "", "cache-mb", "Memory budget in MB for decoded source textures", false, 256, "MB", cmd };
+		std::vector<std::string> formats{ "tga", "png", "dds" };
+		TCLAP::ValuesConstraint<std::string> formatConstraint{ formats };
+		TCLAP::ValueArg<std::string> formatArg{ "f", "format", "Output image format", false, "tga", &formatConstraint, cmd };
+		std::vector<std::string> mipFilters{ "none", "box", "kaiser" };
+		TCLAP::ValuesConstraint<std::string> mipConstraint{ mipFilters };
+		TCLAP::ValueArg<std::string> mipsArg{ "m", "mips", "Filter used to generate mip levels", false, "none", &mipConstraint, cmd };
 
 		cmd.parse(argc, argv);
 
-		for (const std::string& filename : inputArgs.getValue()) {
-			try {
-				std::ifstream inputStream{ filename };
-				if (!inputStream.good())
-					throw std::runtime_error("Could not open Con File");
+		OutputOptions options{ formatArg.getValue(), mipsArg.getValue() != "none", mipsArg.getValue() == "kaiser" ? MipFilter::Kaiser : MipFilter::Box };
+
+		//Many .con files reference the same source texture, decode each one only once
+		ImageCache cache{ size_t(cacheArg.getValue()) * 1024 * 1024, [](const std::string& filename) {
+			auto image = std::make_shared<Image>(Image{ ImageData(nullptr, &free), 0, 0, 0 });
+			image->data = loadImage(filename, image->width, image->height, image->channels);
+			return std::shared_ptr<const Image>(std::move(image));
+		} };
 
-				ConFile conFile = parseConFile(inputStream, textureFolderArg.getValue(), outputFolder.getValue());
-				processFile(conFile);
+		std::mutex logMutex;
+		auto reportError = [&logMutex](const std::string& name, const std::exception& e) {
+			std::lock_guard<std::mutex> lock{ logMutex };
+			std::cerr << "Error at file " << name << ": " << e.what() << std::endl;
+		};
+
+		std::vector<Job> jobs;
+		std::map<std::string, std::vector<ConFile>> atlases;
+		if (atlasArg.getValue()) {
+			//One atlas per character (folder of the .con file) and canvas, items sharing a canvas are blitted into the same image
+			for (const std::string& filename : inputArgs.getValue()) {
+				try {
+					ConFile conFile = parseConFile(filename, textureFolderArg.getValue(), outputFolder.getValue());
+					std::string atlasName = outputFolder.getValue() + '/' + characterName(filename) + '_' + canvasName(conFile.itemType) + ".tga";
+					atlases[atlasName].push_back(conFile);
+				}
+				catch (std::runtime_error& e) {
+					reportError(filename, e);
+				}
 			}
-			catch (std::runtime_error& e) {
-				std::cerr << "Error at file " << filename << ": " << e.what() << std::endl;
+			for (const auto& atlas : atlases) {
+				const std::string& atlasName = atlas.first;
+				const std::vector<ConFile>& items = atlas.second;
+				jobs.push_back(Job{ atlasName, [&atlasName, &items, &options, &cache](std::vector<unsigned char>& outputBuffer) {
+					processAtlas(atlasName, items, options, cache, outputBuffer);
+				} });
 			}
 		}
+		else {
+			for (const std::string& filename : inputArgs.getValue()) {
+				jobs.push_back(Job{ filename, [&filename, &textureFolderArg, &outputFolder, &options, &cache](std::vector<unsigned char>& outputBuffer) {
+					ConFile conFile = parseConFile(filename, textureFolderArg.getValue(), outputFolder.getValue());
+					processFile(conFile, options, cache, outputBuffer);
+				} });
+			}
+		}
+
+		std::atomic<size_t> nextJob{ 0 };
+		auto worker = [&]() {
+			std::vector<unsigned char> outputBuffer;	//reused for every job of this worker
+			for (size_t i = nextJob++; i < jobs.size(); i = nextJob++) {
+				try {
+					jobs[i].run(outputBuffer);
+				}
+				catch (std::runtime_error& e) {
+					reportError(jobs[i].name, e);
+				}
+			}
+		};
+
+		size_t threadCount = std::min<size_t>(std::max(1u, jobsArg.getValue()), jobs.size());
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < threadCount; ++i) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+
+		std::cout << "Texture cache: " << cache.hits() << " hits, " << cache.misses() << " misses" << std::endl;
 	}
 	catch (TCLAP::ArgException& e) {
 		std::cerr << "error: " << e.error() << " at arg " << e.argId() << std::endl;
@@ -59,6 +154,14 @@ int main(int argc, char** argv)
 	return 0;
 }
 
+ConFile parseConFile(const std::string& filename, const std::string& overrideFolder, const std::string& outputFolder)
+{
+	std::ifstream inputStream{ filename };
+	if (!inputStream.good())
+		throw std::runtime_error("Could not open Con File");
+	return parseConFile(inputStream, overrideFolder, outputFolder);
+}
+
 ConFile parseConFile(std::istream& stream, const std::string& overrideFolder, const std::string& outputFolder)
 {
 	ConFile result;
@@ -78,27 +181,149 @@ ConFile parseConFile(std::istream& stream, const std::string& overrideFolder, co
 	return result;
 }
 
-void processFile(const ConFile& file)
+ImageData loadImage(const std::string& filename, int& width, int& height, int& channels)
 {
-	int srcWidth, srcHeight, dstWidth, dstHeight, channels;
+	if (isDdsFile(filename))
+		return decodeDds(readDds(filename), width, height, channels);
+
+	ImageData data(stbi_load(filename.c_str(), &width, &height, &channels, 0), &stbi_image_free);
+	if (!data)
+		throw std::runtime_error("Could not load " + filename + ": " + stbi_failure_reason());
+	return data;
+}
+
+ImageData decodeDds(const DdsImage& image, int& width, int& height, int& channels)
+{
+	std::vector<unsigned char> pixels = image.decode();
+	ImageData data(static_cast<unsigned char*>(malloc(pixels.size())), &free);
+	if (!data)
+		throw std::runtime_error("Out of memory");
+	memcpy(data.get(), pixels.data(), pixels.size());
+	width = image.width;
+	height = image.height;
+	channels = 4;
+	return data;
+}
+
+std::string replaceExtension(const std::string& filename, const std::string& extension)
+{
+	size_t pos = filename.find_last_of("./\\");
+	if (pos == std::string::npos || filename[pos] != '.')
+		return filename + extension;
+	return filename.substr(0, pos) + extension;
+}
+
+void processFile(const ConFile& file, const OutputOptions& options, ImageCache& cache, std::vector<unsigned char>& outputBuffer)
+{
+	int dstWidth, dstHeight;
 	targetSize(file.itemType, dstWidth, dstHeight);
 
-	std::unique_ptr<unsigned char, void(*)(void*)> inputData(
-		stbi_load(file.textureFile.c_str(), &srcWidth, &srcHeight, &channels, 0),
-		&stbi_image_free);
-	std::unique_ptr<unsigned char[]> outputData(new unsigned char[channels*dstWidth*dstHeight]);
+	std::string outputFile = file.outputFile;
+	if (isDdsFile(file.textureFile)) {
+		DdsImage source = readDds(file.textureFile);
+		//Only a dds target can take the source blocks as they are, tga and png targets are decoded
+		bool passthrough = !options.mips && options.format == "dds";
+		if (passthrough && file.xOffset % 4 == 0 && file.yOffset % 4 == 0 && source.width % 4 == 0 && source.height % 4 == 0) {
+			//Block aligned, so the compressed blocks can be copied without decoding
+			DdsImage target{ source.format, dstWidth, dstHeight };
+			target.copyBlocks(source, file.xOffset, file.yOffset);
+			writeDds(replaceExtension(outputFile, ".dds"), target);
+			return;
+		}
+		outputFile = replaceExtension(outputFile, ".tga");
+	}
+	std::shared_ptr<const Image> input = cache.load(file.textureFile);
+	int channels = input->channels;
+	outputBuffer.assign(channels*dstWidth*dstHeight, 0);
 
-	if (srcWidth + file.xOffset > dstWidth || srcHeight + file.yOffset > dstHeight)
-		throw std::runtime_error("Image writing exceeds Bounds");
+	copyImageRegion(input->data.get(), outputBuffer.data(), input->width, input->height, dstWidth, dstHeight, file.xOffset, file.yOffset, channels, channels);
 
-	for (int y = 0; y < srcHeight; ++y) {
-		memcpy(
-			outputData.get() + (file.xOffset + (y+file.yOffset) *dstWidth) * channels,
-			inputData.get() + y*srcWidth * channels,
-			srcWidth * channels);
+	writeImage(outputFile, outputBuffer, dstWidth, dstHeight, channels, options);
+}
+
+void processAtlas(const std::string& outputFile, const std::vector<ConFile>& items, const OutputOptions& options, ImageCache& cache,
+	std::vector<unsigned char>& outputBuffer)
+{
+	int dstWidth, dstHeight;
+	targetSize(items.front().itemType, dstWidth, dstHeight);
+	int dstChannels = 3;
+	std::vector<std::shared_ptr<const Image>> images;
+	for (const ConFile& item : items) {
+		images.push_back(cache.load(item.textureFile));
+		if (images.back()->channels == 4 || images.back()->channels == 2)
+			dstChannels = 4;
+	}
+
+	outputBuffer.assign(dstChannels*dstWidth*dstHeight, 0);
+	for (size_t i = 0; i < items.size(); ++i) {
+		copyImageRegion(images[i]->data.get(), outputBuffer.data(), images[i]->width, images[i]->height, dstWidth, dstHeight,
+			items[i].xOffset, items[i].yOffset, images[i]->channels, dstChannels);
 	}
 
-	stbi_write_tga(file.outputFile.c_str(), dstWidth, dstHeight, channels, outputData.get());
+	writeImage(outputFile, outputBuffer, dstWidth, dstHeight, dstChannels, options);
+}
+
+// Writes the image and, if requested, its mip levels. DDS keeps all levels in one file, tga and png write one file per level
+void writeImage(const std::string& outputFile, std::vector<unsigned char>& pixels, int width, int height, int channels, const OutputOptions& options)
+{
+	std::string filename = options.format == "tga" ? outputFile : replaceExtension(outputFile, "." + options.format);
+	if (options.format == "dds" && channels != 4) {
+		std::vector<unsigned char> rgba(width * height * 4);
+		copyImageRegion(pixels.data(), rgba.data(), width, height, width, height, 0, 0, channels, 4);
+		pixels.swap(rgba);
+		channels = 4;
+	}
+
+	std::vector<MipLevel> mips;
+	if (options.mips)
+		mips = generateMips(pixels.data(), width, height, channels, options.mipFilter);
+
+	if (options.format == "dds") {
+		std::vector<const unsigned char*> levels{ pixels.data() };
+		for (const MipLevel& mip : mips) {
+			levels.push_back(mip.pixels.data());
+		}
+		writeRgbaDds(filename, width, height, levels);
+		return;
+	}
+
+	auto write = [&options, channels](const std::string& filename, const unsigned char* pixels, int width, int height) {
+		bool success = options.format == "png"
+			? stbi_write_png(filename.c_str(), width, height, channels, pixels, width * channels) != 0
+			: stbi_write_tga(filename.c_str(), width, height, channels, pixels) != 0;
+		if (!success)
+			throw std::runtime_error("Can not write to output file " + filename);
+	};
+
+	if (mips.empty()) {
+		write(filename, pixels.data(), width, height);
+		return;
+	}
+
+	//All mip levels together are a third of the base level, so they are encoded on a second thread while the base level is written
+	std::exception_ptr mipError;
+	std::thread mipThread{ [&]() {
+		try {
+			size_t dot = filename.find_last_of("./\\");
+			std::string extension = dot == std::string::npos || filename[dot] != '.' ? "" : filename.substr(dot);
+			for (size_t i = 0; i < mips.size(); ++i) {
+				write(replaceExtension(filename, "_mip" + std::to_string(i + 1) + extension), mips[i].pixels.data(), mips[i].width, mips[i].height);
+			}
+		}
+		catch (...) {
+			mipError = std::current_exception();
+		}
+	} };
+	try {
+		write(filename, pixels.data(), width, height);
+	}
+	catch (...) {
+		mipThread.join();
+		throw;
+	}
+	mipThread.join();
+	if (mipError)
+		std::rethrow_exception(mipError);
 }
 
 void targetSize(ConFile::ItemType type, int& width, int& height)
@@ -122,13 +347,68 @@ void targetSize(ConFile::ItemType type, int& width, int& height)
 	}
 }
 
-void copyImageRegion(const unsigned char* src, unsigned char* dst, int srcWidth, int srcHeight, int dstWidth, int dstHeight, int xOffset, int yOffset, int channels)
+// Items with the same target size share one texture
+const char* canvasName(ConFile::ItemType type)
+{
+	switch (type) {
+	case ConFile::Body:
+	case ConFile::Hands:		return "body";
+	case ConFile::Legs:			return "legs";
+	case ConFile::Feet:			return "feet";
+	case ConFile::Head:
+	case ConFile::HeadHair:		return "head";
+	case ConFile::Hat:
+	case ConFile::Hair:			return "hat";
+	case ConFile::Neck:			return "neck";
+	case ConFile::FaceObj:
+	case ConFile::FaceHair:		return "face";
+	case ConFile::WaistLeft:
+	case ConFile::WaistRight:
+	case ConFile::WaistBack:
+	case ConFile::ChestItem:	return "accessory";
+	}
+	return "unknown";
+}
+
+std::string characterName(const std::string& conFilename)
 {
-	if (srcWidth + xOffset > dstWidth || srcHeight + yOffset > dstHeight)
+	size_t end = conFilename.find_last_of("/\\");
+	if (end == std::string::npos || end == 0)
+		return "character";
+	size_t begin = conFilename.find_last_of("/\\", end - 1);
+	begin = begin == std::string::npos ? 0 : begin + 1;
+	return conFilename.substr(begin, end - begin);
+}
+
+void copyImageRegion(const unsigned char* src, unsigned char* dst, int srcWidth, int srcHeight, int dstWidth, int dstHeight, int xOffset, int yOffset,
+	int srcChannels, int dstChannels)
+{
+	if (xOffset < 0 || yOffset < 0 || srcWidth + xOffset > dstWidth || srcHeight + yOffset > dstHeight)
 		throw std::runtime_error("Image writing exceeds Bounds");
 
+	if (srcChannels == dstChannels) {
+		for (int y = 0; y < srcHeight; ++y) {
+			memcpy(dst + (xOffset + (y+yOffset)*dstWidth) * dstChannels, src + y*srcWidth * srcChannels, srcChannels*srcWidth);
+		}
+		return;
+	}
+
+	//Grey (+alpha) is expanded to rgb, missing alpha becomes opaque and dropped alpha is ignored
 	for (int y = 0; y < srcHeight; ++y) {
-		memcpy(dst + xOffset + (y+yOffset)*dstWidth, src + y*srcWidth, channels*srcWidth);
+		const unsigned char* srcPixel = src + y*srcWidth * srcChannels;
+		unsigned char* dstPixel = dst + (xOffset + (y+yOffset)*dstWidth) * dstChannels;
+		for (int x = 0; x < srcWidth; ++x) {
+			bool grey = srcChannels < 3;
+			dstPixel[0] = srcPixel[0];
+			dstPixel[1] = srcPixel[grey ? 0 : 1];
+			dstPixel[2] = srcPixel[grey ? 0 : 2];
+			if (dstChannels == 4) {
+				bool hasAlpha = srcChannels == 2 || srcChannels == 4;
+				dstPixel[3] = hasAlpha ? srcPixel[srcChannels - 1] : 255;
+			}
+			srcPixel += srcChannels;
+			dstPixel += dstChannels;
+		}
 	}
 }
 
@@ -0,0 +1,215 @@
+#include "Corpus.h"
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+	// Grid of size x size vertices per material, every material of a lod has the same grid size
+	struct MeshSpec {
+		bool bundled;
+		uint32_t geomCount;
+		uint32_t lodCount;
+		uint32_t materialCount;
+		uint32_t gridSize;		//of lod 0, halved for every further lod
+		bool repeatGeometry;	//all materials of a lod get the same vertices
+	};
+
+	struct VertexAttrib {
+		uint16_t flag;
+		uint16_t offset;
+		uint16_t vartype;
+		uint16_t usage;
+	};
+
+	template<typename T> void write(std::ostream& stream, const T& value)
+	{
+		stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+	void writeString(std::ostream& stream, const std::string& text)
+	{
+		write(stream, uint32_t(text.size()));
+		stream.write(text.data(), text.size());
+	}
+
+	uint32_t lodGrid(const MeshSpec& spec, uint32_t lod)
+	{
+		return std::max(2u, spec.gridSize >> lod);
+	}
+
+	// Same layouts as the shipped assets: position, normal, blend indices, uv1, (uv2, uv3,) tangent
+	std::vector<VertexAttrib> vertexAttribs(bool bundled)
+	{
+		std::vector<VertexAttrib> attribs{ { 0, 0, 2, 0 }, { 0, 12, 2, 3 }, { 0, 24, 4, 2 }, { 0, 28, 1, 5 } };
+		if (bundled) {
+			attribs.push_back({ 0, 36, 2, 6 });
+		}
+		else {
+			attribs.push_back({ 0, 36, 1, 0x105 });
+			attribs.push_back({ 0, 44, 1, 0x205 });
+			attribs.push_back({ 0, 52, 2, 6 });
+		}
+		attribs.push_back({ 0xFF, 0, 17, 0 });	//end of the table
+		return attribs;
+	}
+
+	// A wavy height field, material and geometry move it so that materials differ unless they repeat
+	void writeGrid(std::ostream& stream, uint32_t size, uint32_t seed, uint32_t stride)
+	{
+		std::vector<float> vertex(stride / 4, 0.0f);
+		for (uint32_t y = 0; y < size; ++y) {
+			for (uint32_t x = 0; x < size; ++x) {
+				float u = float(x) / (size - 1);
+				float v = float(y) / (size - 1);
+				float phase = 0.37f * seed;
+				float height = 0.5f * std::sin(6.0f * u + phase) * std::cos(4.0f * v - phase);
+				float dx = 1.5f * std::cos(6.0f * u + phase) * std::cos(4.0f * v - phase);
+				float dy = -1.0f * std::sin(6.0f * u + phase) * std::sin(4.0f * v - phase);
+				float length = std::sqrt(dx * dx + dy * dy + 1.0f);
+				vertex[0] = 10.0f * u + seed;
+				vertex[1] = height;
+				vertex[2] = 10.0f * v;
+				vertex[3] = -dx / length;
+				vertex[4] = 1.0f / length;
+				vertex[5] = -dy / length;
+				vertex[7] = u;
+				vertex[8] = v;
+				stream.write(reinterpret_cast<const char*>(vertex.data()), stride);
+			}
+		}
+	}
+
+	void writeMesh(const std::string& filename, const MeshSpec& spec)
+	{
+		std::ofstream stream{ filename, std::ofstream::out | std::ofstream::binary };
+		if (!stream.good())
+			throw std::runtime_error("Can not write generated asset " + filename);
+		const uint32_t version = 11;
+		const uint32_t stride = spec.bundled ? 48 : 64;
+
+		write(stream, uint32_t(0));
+		write(stream, version);
+		for (int i = 0; i < 3; ++i) {
+			write(stream, uint32_t(0));
+		}
+		write(stream, uint8_t(0));
+		write(stream, spec.geomCount);
+		for (uint32_t geom = 0; geom < spec.geomCount; ++geom) {
+			write(stream, spec.lodCount);
+		}
+		std::vector<VertexAttrib> attribs = vertexAttribs(spec.bundled);
+		write(stream, uint32_t(attribs.size()));
+		for (const VertexAttrib& attrib : attribs) {
+			write(stream, attrib);
+		}
+
+		//Vertices of every material of every lod one after another
+		uint32_t vertexCount = 0;
+		uint32_t indexCount = 0;
+		for (uint32_t geom = 0; geom < spec.geomCount; ++geom) {
+			for (uint32_t lod = 0; lod < spec.lodCount; ++lod) {
+				uint32_t size = lodGrid(spec, lod);
+				vertexCount += spec.materialCount * size * size;
+				indexCount += spec.materialCount * (size - 1) * (size - 1) * 6;
+			}
+		}
+		write(stream, uint32_t(4));
+		write(stream, stride);
+		write(stream, vertexCount);
+		for (uint32_t geom = 0; geom < spec.geomCount; ++geom) {
+			for (uint32_t lod = 0; lod < spec.lodCount; ++lod) {
+				for (uint32_t material = 0; material < spec.materialCount; ++material) {
+					writeGrid(stream, lodGrid(spec, lod), spec.repeatGeometry ? geom : geom * spec.materialCount + material, stride);
+				}
+			}
+		}
+
+		//Indices are relative to the first vertex of their material
+		write(stream, indexCount);
+		for (uint32_t geom = 0; geom < spec.geomCount; ++geom) {
+			for (uint32_t lod = 0; lod < spec.lodCount; ++lod) {
+				uint32_t size = lodGrid(spec, lod);
+				for (uint32_t material = 0; material < spec.materialCount; ++material) {
+					for (uint32_t y = 0; y + 1 < size; ++y) {
+						for (uint32_t x = 0; x + 1 < size; ++x) {
+							uint16_t corner = uint16_t(y * size + x);
+							uint16_t quad[6] = { corner, uint16_t(corner + size), uint16_t(corner + 1),
+								uint16_t(corner + 1), uint16_t(corner + size), uint16_t(corner + size + 1) };
+							stream.write(reinterpret_cast<const char*>(quad), sizeof(quad));
+						}
+					}
+				}
+			}
+		}
+
+		write(stream, uint32_t(0));
+		for (uint32_t geom = 0; geom < spec.geomCount; ++geom) {
+			for (uint32_t lod = 0; lod < spec.lodCount; ++lod) {
+				float bounds[6] = { 0.0f, -0.5f, 0.0f, 10.0f + spec.materialCount, 0.5f, 10.0f };
+				stream.write(reinterpret_cast<const char*>(bounds), sizeof(bounds));
+				if (spec.bundled) {
+					write(stream, uint32_t(0));
+				}
+				else {
+					write(stream, uint32_t(1));
+					float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+					stream.write(reinterpret_cast<const char*>(identity), sizeof(identity));
+				}
+			}
+		}
+
+		uint32_t vertexOffset = 0;
+		uint32_t indexOffset = 0;
+		for (uint32_t geom = 0; geom < spec.geomCount; ++geom) {
+			for (uint32_t lod = 0; lod < spec.lodCount; ++lod) {
+				uint32_t size = lodGrid(spec, lod);
+				write(stream, spec.materialCount);
+				for (uint32_t material = 0; material < spec.materialCount; ++material) {
+					write(stream, uint32_t(0));	//opaque
+					writeString(stream, spec.bundled ? "Common\\Shaders\\BundledMesh.fx" : "Common\\Shaders\\StaticMesh.fx");
+					writeString(stream, "Base");
+					write(stream, uint32_t(1));
+					writeString(stream, "generated/texture_" + std::to_string(material) + ".dds");
+					write(stream, vertexOffset);
+					write(stream, indexOffset);
+					write(stream, (size - 1) * (size - 1) * 6);
+					write(stream, size * size);
+					write(stream, uint32_t(0));
+					write(stream, uint32_t(0));
+					if (!spec.bundled) {
+						float bounds[6] = { 0.0f, -0.5f, 0.0f, 10.0f, 0.5f, 10.0f };
+						stream.write(reinterpret_cast<const char*>(bounds), sizeof(bounds));
+					}
+					vertexOffset += size * size;
+					indexOffset += (size - 1) * (size - 1) * 6;
+				}
+			}
+		}
+		if (!stream.good())
+			throw std::runtime_error("Can not write generated asset " + filename);
+	}
+}
+
+std::vector<std::string> generateCorpus(const std::string& folder)
+{
+	struct Asset {
+		const char* name;
+		MeshSpec spec;
+	};
+	const Asset assets[] = {
+		{ "gen_terrain.staticmesh", { false, 1, 3, 4, 250, false } },
+		{ "gen_props.staticmesh", { false, 1, 2, 200, 16, false } },
+		{ "gen_repeated.staticmesh", { false, 1, 1, 12, 100, true } },
+		{ "gen_vehicle.bundledmesh", { true, 2, 3, 3, 120, false } },
+	};
+
+	std::vector<std::string> files;
+	for (const Asset& asset : assets) {
+		std::string filename = folder + "/" + asset.name;
+		writeMesh(filename, asset.spec);
+		files.push_back(filename);
+	}
+	return files;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Synthetic meshes that complete the sample assets: one large static mesh, one with many small materials,
+// one whose materials repeat the same geometry and a bundled mesh with several geometries.
+// They are written in the binary formats the converter reads and are identical on every run
+std::vector<std::string> generateCorpus(const std::string& folder);
@@ -0,0 +1,408 @@
+#include "Equivalence.h"
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <rapidxml/rapidxml.hpp>
+#include <rapidjson/document.h>
+
+using namespace rapidxml;
+
+namespace {
+	bool closeEnough(double actual, double expected, double tolerance)
+	{
+		if (actual == expected || (std::isnan(actual) && std::isnan(expected)))
+			return true;
+		return std::fabs(actual - expected) <= tolerance * std::max({ 1.0, std::fabs(actual), std::fabs(expected) });
+	}
+
+	std::string extension(const std::string& name)
+	{
+		size_t pos = name.find_last_of('.');
+		return pos == std::string::npos ? "" : name.substr(pos + 1);
+	}
+
+	// Token by token, tokens that are numbers on both sides are compared within tolerance
+	std::string compareText(const char* actual, const char* expected, double tolerance)
+	{
+		auto nextToken = [](const char*& text, std::string& token) {
+			while (*text && isspace(static_cast<unsigned char>(*text))) {
+				++text;
+			}
+			const char* begin = text;
+			while (*text && !isspace(static_cast<unsigned char>(*text))) {
+				++text;
+			}
+			token.assign(begin, text);
+			return !token.empty();
+		};
+		auto toNumber = [](const std::string& token, double& value) {
+			char* end;
+			value = strtod(token.c_str(), &end);
+			return *end == '\0';
+		};
+
+		std::string a, b;
+		for (size_t index = 0; ; ++index) {
+			bool hasA = nextToken(actual, a);
+			bool hasB = nextToken(expected, b);
+			if (!hasA && !hasB)
+				return "";
+			if (hasA != hasB)
+				return "token count differs after " + std::to_string(index) + " tokens";
+			double valueA, valueB;
+			if (toNumber(a, valueA) && toNumber(b, valueB)) {
+				if (!closeEnough(valueA, valueB, tolerance))
+					return "value " + std::to_string(index) + " is " + a + " instead of " + b;
+			}
+			else if (a != b) {
+				return "token " + std::to_string(index) + " is " + a + " instead of " + b;
+			}
+		}
+	}
+
+	std::string compareXmlNodes(const xml_node<>* actual, const xml_node<>* expected, double tolerance, const std::string& path)
+	{
+		std::string name = path + "/" + std::string(expected->name(), expected->name_size());
+		if (actual->type() != expected->type() || std::strcmp(actual->name(), expected->name()) != 0)
+			return name + ": element " + actual->name() + " instead of " + expected->name();
+
+		const xml_attribute<>* attributeA = actual->first_attribute();
+		const xml_attribute<>* attributeB = expected->first_attribute();
+		for (; attributeA && attributeB; attributeA = attributeA->next_attribute(), attributeB = attributeB->next_attribute()) {
+			if (std::strcmp(attributeA->name(), attributeB->name()) != 0)
+				return name + ": attribute " + attributeA->name() + " instead of " + attributeB->name();
+			std::string difference = compareText(attributeA->value(), attributeB->value(), tolerance);
+			if (!difference.empty())
+				return name + "@" + attributeB->name() + ": " + difference;
+		}
+		if (attributeA || attributeB)
+			return name + ": attribute count differs";
+
+		std::string difference = compareText(actual->value(), expected->value(), tolerance);
+		if (!difference.empty())
+			return name + ": " + difference;
+
+		const xml_node<>* childA = actual->first_node();
+		const xml_node<>* childB = expected->first_node();
+		for (; childA && childB; childA = childA->next_sibling(), childB = childB->next_sibling()) {
+			if (childA->type() == node_data && childB->type() == node_data)
+				continue;	//already compared as the value of the parent
+			difference = compareXmlNodes(childA, childB, tolerance, name);
+			if (!difference.empty())
+				return difference;
+		}
+		if (childA || childB)
+			return name + ": child count differs";
+		return "";
+	}
+
+	std::string compareXml(std::string actual, std::string expected, double tolerance)
+	{
+		xml_document<> docA, docB;
+		try {
+			docA.parse<0>(&actual[0]);
+			docB.parse<0>(&expected[0]);
+		}
+		catch (parse_error& e) {
+			return std::string("not valid XML: ") + e.what();
+		}
+		const xml_node<>* rootA = docA.first_node();
+		const xml_node<>* rootB = docB.first_node();
+		if (!rootA || !rootB)
+			return rootA == rootB ? "" : "document is empty";
+		return compareXmlNodes(rootA, rootB, tolerance, "");
+	}
+
+	std::string compareJsonValues(const rapidjson::Value& actual, const rapidjson::Value& expected, double tolerance, const std::string& path)
+	{
+		if (actual.IsNumber() && expected.IsNumber()) {
+			if (!closeEnough(actual.GetDouble(), expected.GetDouble(), tolerance))
+				return path + ": " + std::to_string(actual.GetDouble()) + " instead of " + std::to_string(expected.GetDouble());
+			return "";
+		}
+		if (actual.GetType() != expected.GetType())
+			return path + ": type differs";
+		if (actual.IsString()) {
+			if (std::strcmp(actual.GetString(), expected.GetString()) != 0)
+				return path + ": " + actual.GetString() + " instead of " + expected.GetString();
+		}
+		else if (actual.IsArray()) {
+			if (actual.Size() != expected.Size())
+				return path + ": " + std::to_string(actual.Size()) + " elements instead of " + std::to_string(expected.Size());
+			for (rapidjson::SizeType i = 0; i < actual.Size(); ++i) {
+				std::string difference = compareJsonValues(actual[i], expected[i], tolerance, path + "[" + std::to_string(i) + "]");
+				if (!difference.empty())
+					return difference;
+			}
+		}
+		else if (actual.IsObject()) {
+			if (actual.MemberCount() != expected.MemberCount())
+				return path + ": member count differs";
+			for (auto member = expected.MemberBegin(); member != expected.MemberEnd(); ++member) {
+				auto found = actual.FindMember(member->name);
+				std::string memberPath = path + "." + member->name.GetString();
+				if (found == actual.MemberEnd())
+					return memberPath + ": missing";
+				std::string difference = compareJsonValues(found->value, member->value, tolerance, memberPath);
+				if (!difference.empty())
+					return difference;
+			}
+		}
+		else if (actual != expected) {
+			return path + ": value differs";
+		}
+		return "";
+	}
+
+	std::string compareJson(const std::string& actual, const std::string& expected, double tolerance)
+	{
+		rapidjson::Document docA, docB;
+		docA.Parse(actual.c_str(), actual.size());
+		docB.Parse(expected.c_str(), expected.size());
+		if (docA.HasParseError() || docB.HasParseError())
+			return "not valid JSON";
+		return compareJsonValues(docA, docB, tolerance, "");
+	}
+
+	template<typename T> std::string compareNumbers(const char* actual, const char* expected, size_t size, double tolerance)
+	{
+		for (size_t i = 0; i < size / sizeof(T); ++i) {
+			T a, b;
+			memcpy(&a, actual + i * sizeof(T), sizeof(T));
+			memcpy(&b, expected + i * sizeof(T), sizeof(T));
+			if (memcmp(&a, &b, sizeof(T)) != 0 && !closeEnough(a, b, tolerance))
+				return "value " + std::to_string(i) + " is " + std::to_string(a) + " instead of " + std::to_string(b);
+		}
+		return "";
+	}
+
+	// Outputs without a parser have to be identical
+	std::string compareBytes(const std::string& actual, const std::string& expected)
+	{
+		if (actual.size() != expected.size())
+			return std::to_string(actual.size()) + " bytes instead of " + std::to_string(expected.size());
+		return actual == expected ? "" : "bytes differ";
+	}
+
+	// Walks a binary output and its reference field by field. Integers and raw fields have to match, only floats are compared
+	// within tolerance. After the first difference every call does nothing, counts are taken from the reference
+	class FieldComparer
+	{
+	public:
+		FieldComparer(const std::string& actual, const std::string& expected, double tolerance)
+			:actual(actual), expected(expected), tolerance(tolerance)
+		{
+			if (actual.size() != expected.size())
+				error = std::to_string(actual.size()) + " bytes instead of " + std::to_string(expected.size());
+		}
+
+		void bytes(uint64_t size, const std::string& field)
+		{
+			if (!check(size, 1, field))
+				return;
+			if (memcmp(actual.data() + pos, expected.data() + pos, size_t(size)) != 0)
+				error = field + " differs";
+			pos += size_t(size);
+		}
+
+		template<typename T> T integer(const std::string& field)
+		{
+			T a = 0, b = 0;
+			if (!check(1, sizeof(T), field))
+				return b;
+			memcpy(&a, actual.data() + pos, sizeof(T));
+			memcpy(&b, expected.data() + pos, sizeof(T));
+			if (a != b)
+				error = field + " is " + std::to_string(a) + " instead of " + std::to_string(b);
+			pos += sizeof(T);
+			return b;
+		}
+
+		void floats(uint64_t count, const std::string& field)
+		{
+			if (!check(count, sizeof(float), field))
+				return;
+			std::string difference = compareNumbers<float>(actual.data() + pos, expected.data() + pos, size_t(count) * sizeof(float), tolerance);
+			if (!difference.empty())
+				error = field + ": " + difference;
+			pos += size_t(count) * sizeof(float);
+		}
+
+		bool failed() const { return !error.empty(); }
+
+		// The first difference, or trailing bytes the format does not have
+		std::string finish()
+		{
+			if (error.empty() && pos != expected.size())
+				error = std::to_string(expected.size() - pos) + " bytes after the last field";
+			return error;
+		}
+
+	private:
+		bool check(uint64_t count, size_t elementSize, const std::string& field)
+		{
+			if (!error.empty())
+				return false;
+			if (count > (expected.size() - pos) / elementSize) {
+				error = field + ": ends early";
+				return false;
+			}
+			return true;
+		}
+
+		const std::string& actual;
+		const std::string& expected;
+		double tolerance;
+		size_t pos = 0;
+		std::string error;
+	};
+
+	// Pose caches (.bfpose) and vertex caches (.bfvc): a header and per frame floatsPerItem floats of every bone or vertex
+	std::string compareCache(const std::string& actual, const std::string& expected, double tolerance, uint64_t floatsPerItem)
+	{
+		FieldComparer fields{ actual, expected, tolerance };
+		fields.bytes(4, "magic");
+		fields.integer<uint32_t>("version");
+		uint64_t itemCount = fields.integer<uint32_t>("count");
+		uint64_t frameCount = fields.integer<uint32_t>("frame count");
+		fields.floats(itemCount * frameCount * floatsPerItem, "frames");
+		return fields.finish();
+	}
+
+	// Clips (.bfclip): the ranges of the tracks are floats, the quantized samples have to be identical
+	std::string compareClip(const std::string& actual, const std::string& expected, double tolerance)
+	{
+		FieldComparer fields{ actual, expected, tolerance };
+		fields.bytes(4, "magic");
+		fields.integer<uint32_t>("version");
+		uint16_t boneCount = fields.integer<uint16_t>("bone count");
+		uint64_t frameCount = fields.integer<uint32_t>("frame count");
+		uint64_t animatedTracks = 0;
+		for (uint16_t bone = 0; bone < boneCount && !fields.failed(); ++bone) {
+			std::string name = "bone " + std::to_string(bone);
+			fields.integer<uint16_t>(name + " id");
+			uint8_t animatedMask = fields.integer<uint8_t>(name + " mask");
+			for (int track = 0; track < 7; ++track) {
+				fields.floats(1, name + " track " + std::to_string(track) + " minimum");
+				if (animatedMask & (1 << track)) {
+					fields.floats(1, name + " track " + std::to_string(track) + " range");
+					++animatedTracks;
+				}
+			}
+		}
+		fields.bytes(frameCount * animatedTracks * sizeof(uint16_t), "samples");
+		return fields.finish();
+	}
+
+	// Acceleration data of collision meshes (.bfaccel): only the bounds are floats, tree nodes are kept as raw words
+	std::string compareAccel(const std::string& actual, const std::string& expected, double tolerance)
+	{
+		FieldComparer fields{ actual, expected, tolerance };
+		fields.bytes(4, "magic");
+		fields.integer<uint32_t>("export version");
+		fields.integer<uint32_t>("version");
+		uint32_t lodCount = fields.integer<uint32_t>("lod count");
+		for (uint32_t lod = 0; lod < lodCount && !fields.failed(); ++lod) {
+			std::string name = "lod " + std::to_string(lod);
+			fields.integer<uint32_t>(name + " geometry");
+			fields.integer<uint32_t>(name + " subgeometry");
+			fields.integer<uint32_t>(name + " lod");
+			fields.integer<uint32_t>(name + " coltype");
+			fields.floats(6, name + " bounds");
+			uint64_t nodeCount = fields.integer<uint32_t>(name + " node count");
+			fields.bytes(nodeCount * 4 * sizeof(uint32_t), name + " tree nodes");
+			uint64_t faceCount = fields.integer<uint32_t>(name + " face count");
+			fields.bytes(faceCount * sizeof(uint16_t), name + " tree faces");
+			uint64_t extraCount = fields.integer<uint32_t>(name + " extra count");
+			fields.bytes(extraCount * sizeof(uint32_t), name + " tree extra");
+		}
+		return fields.finish();
+	}
+
+	// Entries of an uncompressed zip by name, empty if it is not one
+	std::map<std::string, std::string> readStoredZip(const std::string& data)
+	{
+		std::map<std::string, std::string> entries;
+		size_t pos = 0;
+		while (pos + 30 <= data.size()) {
+			auto read16 = [&data](size_t at) { return uint32_t(uint8_t(data[at])) | uint32_t(uint8_t(data[at + 1])) << 8; };
+			auto read32 = [&](size_t at) { return read16(at) | read16(at + 2) << 16; };
+			if (read32(pos) != 0x04034B50)
+				break;	//central directory
+			uint32_t method = read16(pos + 8);
+			uint32_t size = read32(pos + 18);
+			uint32_t nameLength = read16(pos + 26);
+			uint32_t extraLength = read16(pos + 28);
+			size_t dataPos = pos + 30 + nameLength + extraLength;
+			if (method != 0 || dataPos + size > data.size())
+				return {};
+			entries[data.substr(pos + 30, nameLength)] = data.substr(dataPos, size);
+			pos = dataPos + size;
+		}
+		return entries;
+	}
+
+	// Headers have to match, the data of float arrays is compared within tolerance
+	std::string compareNpy(const std::string& actual, const std::string& expected, double tolerance)
+	{
+		if (actual.size() < 10 || expected.size() < 10 || actual.compare(0, 6, "\x93NUMPY") != 0)
+			return "not an npy array";
+		size_t headerSize = 10 + (uint8_t(expected[8]) | uint8_t(expected[9]) << 8);
+		if (actual.compare(0, headerSize, expected, 0, headerSize) != 0)
+			return "header differs";
+		if (actual.size() != expected.size())
+			return "size differs";
+		std::string header = expected.substr(10, headerSize - 10);
+		const char* data = actual.data() + headerSize;
+		const char* expectedData = expected.data() + headerSize;
+		size_t size = actual.size() - headerSize;
+		if (header.find("'<f4'") != std::string::npos)
+			return compareNumbers<float>(data, expectedData, size, tolerance);
+		if (header.find("'<f8'") != std::string::npos)
+			return compareNumbers<double>(data, expectedData, size, tolerance);
+		return memcmp(data, expectedData, size) == 0 ? "" : "values differ";
+	}
+
+	std::string compareNpz(const std::string& actual, const std::string& expected, double tolerance)
+	{
+		std::map<std::string, std::string> entriesA = readStoredZip(actual);
+		std::map<std::string, std::string> entriesB = readStoredZip(expected);
+		if (entriesB.empty())
+			return compareBytes(actual, expected);
+		for (const auto& entry : entriesB) {
+			auto found = entriesA.find(entry.first);
+			if (found == entriesA.end())
+				return entry.first + ": missing";
+			std::string difference = compareNpy(found->second, entry.second, tolerance);
+			if (!difference.empty())
+				return entry.first + ": " + difference;
+		}
+		if (entriesA.size() != entriesB.size())
+			return "contains other arrays";
+		return "";
+	}
+}
+
+std::string compareOutputs(const std::string& name, const std::string& actual, const std::string& expected, double tolerance)
+{
+	std::string type = extension(name);
+	if (type == "dae")
+		return compareXml(actual, expected, tolerance);
+	if (type == "json")
+		return compareJson(actual, expected, tolerance);
+	if (type == "npz")
+		return compareNpz(actual, expected, tolerance);
+	if (type == "bfpose")
+		return compareCache(actual, expected, tolerance, 12);
+	if (type == "bfvc")
+		return compareCache(actual, expected, tolerance, 3);
+	if (type == "bfclip")
+		return compareClip(actual, expected, tolerance);
+	if (type == "bfaccel")
+		return compareAccel(actual, expected, tolerance);
+	return compareBytes(actual, expected);
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <string>
+
+// Compares an output with its reference by content instead of bytes, so that changes of number formatting pass.
+// COLLADA documents must have the same elements and attributes, json files the same members, and the arrays in npz files
+// the same names, types and shapes. The binary caches (.bfpose, .bfclip, .bfvc, .bfaccel) are parsed field by field.
+// Floats in all of them may differ by tolerance relative to their magnitude (absolute below 1), everything else, e.g.
+// counts, indices and quantized samples, and any other output has to be identical.
+// name selects the format by its extension. Returns an empty string if both are equivalent, else the first difference
+std::string compareOutputs(const std::string& name, const std::string& actual, const std::string& expected, double tolerance);
@@ -0,0 +1,148 @@
+#include "Process.h"
+#include <chrono>
+#include <stdexcept>
+#include <cerrno>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <direct.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+namespace {
+	// Quoted so that CommandLineToArgvW gives back the original argument
+	std::string quoteArgument(const std::string& argument)
+	{
+		std::string quoted = "\"";
+		size_t backslashes = 0;
+		for (char c : argument) {
+			if (c == '\\') {
+				++backslashes;
+				continue;
+			}
+			quoted.append(c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+			backslashes = 0;
+			quoted.push_back(c);
+		}
+		quoted.append(backslashes * 2, '\\');
+		return quoted + "\"";
+	}
+}
+
+ProcessResult runProcess(const std::string& program, const std::vector<std::string>& arguments, const std::string& logFile)
+{
+	std::string commandLine = quoteArgument(program);
+	for (const std::string& argument : arguments) {
+		commandLine += " " + quoteArgument(argument);
+	}
+
+	SECURITY_ATTRIBUTES inherit{ sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+	HANDLE log = CreateFileA(logFile.c_str(), GENERIC_WRITE, FILE_SHARE_READ, &inherit, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (log == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Can not write to log file " + logFile);
+	STARTUPINFOA startup{};
+	startup.cb = sizeof(startup);
+	startup.dwFlags = STARTF_USESTDHANDLES;
+	startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+	startup.hStdOutput = log;
+	startup.hStdError = log;
+	PROCESS_INFORMATION process{};
+
+	auto begin = std::chrono::steady_clock::now();
+	if (!CreateProcessA(nullptr, &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &process)) {
+		CloseHandle(log);
+		throw std::runtime_error("Can not start " + program);
+	}
+	WaitForSingleObject(process.hProcess, INFINITE);
+	auto end = std::chrono::steady_clock::now();
+
+	ProcessResult result{ -1, std::chrono::duration<double>(end - begin).count(), 0 };
+	DWORD exitCode;
+	if (GetExitCodeProcess(process.hProcess, &exitCode))
+		result.exitCode = int(exitCode);
+	PROCESS_MEMORY_COUNTERS memory{};
+	if (GetProcessMemoryInfo(process.hProcess, &memory, sizeof(memory)))
+		result.peakRss = memory.PeakWorkingSetSize;
+	CloseHandle(process.hThread);
+	CloseHandle(process.hProcess);
+	CloseHandle(log);
+	return result;
+}
+
+void createFolders(const std::string& folder)
+{
+	for (size_t pos = folder.find_first_of("/\\", 1); ; pos = folder.find_first_of("/\\", pos + 1)) {
+		std::string path = folder.substr(0, pos);
+		if (!path.empty() && path.back() != ':' && _mkdir(path.c_str()) != 0 && errno != EEXIST)
+			throw std::runtime_error("Can not create folder " + path);
+		if (pos == std::string::npos)
+			break;
+	}
+}
+#else
+ProcessResult runProcess(const std::string& program, const std::vector<std::string>& arguments, const std::string& logFile)
+{
+	int log = open(logFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (log < 0)
+		throw std::runtime_error("Can not write to log file " + logFile);
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>(program.c_str()));
+	for (const std::string& argument : arguments) {
+		argv.push_back(const_cast<char*>(argument.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	auto begin = std::chrono::steady_clock::now();
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(log);
+		throw std::runtime_error("Can not start " + program);
+	}
+	if (pid == 0) {
+		dup2(log, STDOUT_FILENO);
+		dup2(log, STDERR_FILENO);
+		execvp(program.c_str(), argv.data());
+		_exit(127);
+	}
+	close(log);
+
+	//wait4 reports the peak of this child only, RUSAGE_CHILDREN would be the maximum over all runs
+	int status;
+	rusage usage{};
+	while (wait4(pid, &status, 0, &usage) < 0) {
+		if (errno != EINTR)
+			throw std::runtime_error("Can not wait for " + program);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	ProcessResult result{ WIFEXITED(status) ? WEXITSTATUS(status) : -1, std::chrono::duration<double>(end - begin).count(), 0 };
+#ifdef __APPLE__
+	result.peakRss = size_t(usage.ru_maxrss);
+#else
+	result.peakRss = size_t(usage.ru_maxrss) * 1024;
+#endif
+	if (result.exitCode == 127)
+		throw std::runtime_error("Can not start " + program);
+	return result;
+}
+
+void createFolders(const std::string& folder)
+{
+	for (size_t pos = folder.find('/', 1); ; pos = folder.find('/', pos + 1)) {
+		std::string path = folder.substr(0, pos);
+		if (!path.empty() && mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+			throw std::runtime_error("Can not create folder " + path);
+		if (pos == std::string::npos)
+			break;
+	}
+}
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+#include <vector>
+
+struct ProcessResult {
+	int exitCode;		//-1 if the process did not exit normally
+	double seconds;		//wall clock time
+	size_t peakRss;		//bytes, peak working set on Windows
+};
+
+// Runs program with arguments and waits for it, its stdout and stderr are written to logFile.
+// Throws std::runtime_error if the program can not be started
+ProcessResult runProcess(const std::string& program, const std::vector<std::string>& arguments, const std::string& logFile);
+
+// Creates folder and all missing parents
+void createFolders(const std::string& folder);
@@ -0,0 +1,477 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <tclap/CmdLine.h>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include "Process.h"
+#include "Corpus.h"
+#include "Equivalence.h"
+
+struct FormatRun {
+	std::string format;
+	std::string io;						//file I/O backend of the converter
+	std::vector<std::string> inputs;
+	std::map<std::string, std::vector<std::string>> outputs;	//by file name of the input, relative to the output folder of the format
+	size_t inputBytes = 0;
+	size_t outputBytes = 0;
+	double seconds = 0.0;				//fastest of all repeats
+	size_t peakRss = 0;					//highest of all repeats
+	std::vector<std::string> errors;
+	std::vector<std::string> notes;		//reported without failing the run
+
+	std::string name() const { return format + "-" + io; }
+};
+struct Options {
+	std::string converter;
+	std::string workFolder;
+	std::vector<std::string> extraArgs;
+	unsigned repeat;
+};
+
+std::vector<FormatRun> planRuns(const std::vector<std::string>& files, const std::vector<std::string>& ioBackends);
+void runFormat(FormatRun& run, const Options& options, const std::string& skeleton, const std::vector<std::string>& animations);
+void updateReference(const FormatRun& run, const std::string& outputFolder, const std::string& referenceFolder);
+void checkReference(FormatRun& run, const std::string& outputFolder, const std::string& referenceFolder, double tolerance);
+void writeBaseline(const std::vector<FormatRun>& runs, const std::string& filename);
+rapidjson::Document readBaseline(const std::string& filename);
+bool printReport(const std::vector<FormatRun>& runs, const rapidjson::Document& baseline, double threshold);
+std::string readFile(const std::string& filename);
+void writeFile(const std::string& filename, const std::string& data);
+size_t fileSize(const std::string& filename);
+std::string getExtension(const std::string& filename);
+std::string baseName(const std::string& filename);
+std::string fileName(const std::string& filename);
+std::string folderOf(const std::string& filename);
+std::vector<std::string> splitArguments(const std::string& text);
+
+int main(int argc, char** argv)
+{
+	try {
+		TCLAP::CmdLine cmd{ "Measures the throughput of bfAssetConverter over a corpus of assets and checks its outputs against a reference", ' ', "1.0" };
+		TCLAP::UnlabeledMultiArg<std::string> fileArgs{ "filenames", "Assets of the corpus, a .ske file is used as skeleton", false, "filename", cmd };
+		TCLAP::ValueArg<std::string> converterArg{ "c", "converter", "Converter executable, by default the one next to this program", false, "", "filename", cmd };
+		TCLAP::ValueArg<std::string> workArg{ "w", "work", "Folder for the generated assets, outputs and logs", false, "bench_work", "folder", cmd };
+		TCLAP::ValueArg<std::string> referenceArg{ "r", "reference", "Folder with the reference outputs of every format", false, "", "folder", cmd };
+		TCLAP::ValueArg<std::string> baselineArg{ "b", "baseline", "Timings and memory of a previous run", false, "", "file.json", cmd };
+		TCLAP::SwitchArg updateArg{ "u", "update", "Replace the reference outputs and the baseline with the results of this run", cmd };
+		TCLAP::ValueArg<unsigned> repeatArg{ "n", "repeat", "Runs per format, the fastest one counts", false, 3, "count", cmd };
+		TCLAP::ValueArg<double> toleranceArg{ "t", "tolerance", "Relative difference allowed for numbers in the outputs", false, 1e-5, "value", cmd };
+		TCLAP::ValueArg<double> thresholdArg{ "", "threshold", "Slowdown or memory growth against the baseline reported as regression", false, 10.0, "percent", cmd };
+		TCLAP::SwitchArg noGeneratedArg{ "", "no-generated", "Only convert the given assets", cmd };
+		TCLAP::ValueArg<std::string> argsArg{ "", "args", "Additional converter arguments, separated by spaces", false, "", "arguments", cmd };
+		std::vector<std::string> ioChoices{ "blocking", "uring", "both" };
+		TCLAP::ValuesConstraint<std::string> ioConstraint{ ioChoices };
+#ifdef __linux__
+		const std::string defaultIo = "both";
+#else
+		const std::string defaultIo = "blocking";
+#endif
+		TCLAP::ValueArg<std::string> ioArg{ "", "io", "File I/O backend of the converter, both runs every format once with each", false, defaultIo, &ioConstraint, cmd };
+
+		cmd.parse(argc, argv);
+
+		Options options;
+		options.converter = converterArg.getValue();
+		if (options.converter.empty()) {
+#ifdef _WIN32
+			options.converter = folderOf(argv[0]) + "bfAssetConverter.exe";
+#else
+			options.converter = folderOf(argv[0]) + "bfAssetConverter";
+#endif
+		}
+		options.workFolder = workArg.getValue();
+		options.extraArgs = splitArguments(argsArg.getValue());
+		options.repeat = std::max(1u, repeatArg.getValue());
+		if (updateArg.getValue() && !referenceArg.isSet() && !baselineArg.isSet())
+			throw std::runtime_error("Nothing to update without a reference folder or baseline file");
+
+		std::vector<std::string> files;
+		std::string skeleton;
+		for (const std::string& file : fileArgs.getValue()) {
+			if (getExtension(file) == "ske") {
+				if (!skeleton.empty())
+					throw std::runtime_error("Only one skeleton is supported");
+				skeleton = file;
+			}
+			else {
+				files.push_back(file);
+			}
+		}
+		if (!noGeneratedArg.getValue()) {
+			std::string corpusFolder = options.workFolder + "/corpus";
+			createFolders(corpusFolder);
+			for (const std::string& file : generateCorpus(corpusFolder)) {
+				files.push_back(file);
+			}
+		}
+		if (files.empty())
+			throw std::runtime_error("No files to convert");
+		std::vector<std::string> animations;
+		for (const std::string& file : files) {
+			if (getExtension(file) == "baf")
+				animations.push_back(file);
+		}
+
+		std::vector<std::string> ioBackends;
+		if (ioArg.getValue() == "both")
+			ioBackends = { "blocking", "uring" };
+		else
+			ioBackends = { ioArg.getValue() };
+
+		//All backends of a format share one reference, with -u the first run of a format stores it and the others are checked against it
+		std::vector<FormatRun> runs = planRuns(files, ioBackends);
+		std::vector<std::string> updatedFormats;
+		for (FormatRun& run : runs) {
+			std::cout << "Converting " << run.inputs.size() << " files to " << run.format << " with " << run.io << " I/O" << std::endl;
+			runFormat(run, options, skeleton, animations);
+			if (!run.errors.empty() || !referenceArg.isSet())
+				continue;
+			std::string outputFolder = options.workFolder + "/out/" + run.name();
+			std::string referenceFolder = referenceArg.getValue() + "/" + run.format;
+			bool updated = std::find(updatedFormats.begin(), updatedFormats.end(), run.format) != updatedFormats.end();
+			if (updateArg.getValue() && !updated) {
+				updateReference(run, outputFolder, referenceFolder);
+				updatedFormats.push_back(run.format);
+			}
+			else {
+				checkReference(run, outputFolder, referenceFolder, toleranceArg.getValue());
+			}
+		}
+
+		rapidjson::Document baseline;
+		if (baselineArg.isSet()) {
+			if (updateArg.getValue())
+				writeBaseline(runs, baselineArg.getValue());
+			else
+				baseline = readBaseline(baselineArg.getValue());
+		}
+		if (!printReport(runs, baseline, thresholdArg.getValue()))
+			return 1;
+	}
+	catch (TCLAP::ArgException& e) {
+		std::cerr << "error: " << e.error() << " at arg " << e.argId() << std::endl;
+		return -1;
+	}
+	catch (std::runtime_error& e) {
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+// Every format with the inputs it supports once per I/O backend, formats without inputs are left out
+std::vector<FormatRun> planRuns(const std::vector<std::string>& files, const std::vector<std::string>& ioBackends)
+{
+	std::vector<FormatRun> runs;
+	for (const char* format : { "dae", "npz", "poses", "clip", "vcache", "accel" }) {
+		FormatRun run;
+		run.format = format;
+		for (const std::string& file : files) {
+			std::string extension = getExtension(file);
+			bool animation = extension == "baf";
+			bool supported = run.format == "dae" || run.format == "npz" || ((run.format == "poses" || run.format == "clip") && animation)
+				|| (run.format == "vcache" && extension == "skinnedmesh") || (run.format == "accel" && extension == "collisionmesh");
+			if (supported) {
+				run.inputs.push_back(file);
+				run.inputBytes += fileSize(file);
+			}
+		}
+		if (run.inputs.empty())
+			continue;
+		for (const std::string& io : ioBackends) {
+			run.io = io;
+			runs.push_back(run);
+		}
+	}
+	return runs;
+}
+
+void runFormat(FormatRun& run, const Options& options, const std::string& skeleton, const std::vector<std::string>& animations)
+{
+	std::string outputFolder = options.workFolder + "/out/" + run.name();
+	createFolders(outputFolder);
+	std::vector<std::string> arguments = options.extraArgs;
+	arguments.insert(arguments.end(), { "-f", run.format, "--io", run.io });
+	if (!skeleton.empty())
+		arguments.insert(arguments.end(), { "-s", skeleton });
+	if (run.format == "vcache") {
+		for (const std::string& animation : animations) {
+			arguments.insert(arguments.end(), { "-a", animation });
+		}
+		run.inputBytes = std::accumulate(animations.begin(), animations.end(), run.inputBytes,
+			[](size_t sum, const std::string& animation) { return sum + fileSize(animation); });
+	}
+	arguments.insert(arguments.end(), run.inputs.begin(), run.inputs.end());
+	for (const std::string& input : run.inputs) {
+		arguments.insert(arguments.end(), { "-o", outputFolder + "/" + baseName(input) });
+	}
+
+	std::string logFile = options.workFolder + "/" + run.name() + ".log";
+	for (unsigned i = 0; i < options.repeat; ++i) {
+		ProcessResult result = runProcess(options.converter, arguments, logFile);
+		run.seconds = i == 0 ? result.seconds : std::min(run.seconds, result.seconds);
+		run.peakRss = std::max(run.peakRss, result.peakRss);
+		if (result.exitCode != 0) {
+			run.errors.push_back("converter exited with " + std::to_string(result.exitCode) + ", see " + logFile);
+			return;
+		}
+	}
+
+	//The converter reports every input, failed files and every written output in its log. The outputs follow their input
+	std::ifstream log{ logFile };
+	std::string line;
+	std::vector<std::string>* inputOutputs = nullptr;
+	const std::string inputPrefix = "Converting ";
+	const std::string outputPrefix = "   -->" + outputFolder + "/";
+	while (std::getline(log, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.compare(0, inputPrefix.size(), inputPrefix) == 0) {
+			inputOutputs = &run.outputs[fileName(line.substr(inputPrefix.size()))];
+		}
+		else if (line.compare(0, outputPrefix.size(), outputPrefix) == 0 && inputOutputs) {
+			inputOutputs->push_back(line.substr(outputPrefix.size()));
+			run.outputBytes += fileSize(outputFolder + "/" + inputOutputs->back());
+		}
+		else if (line.compare(0, 13, "Error at file") == 0) {
+			run.errors.push_back(line);
+		}
+	}
+	for (auto& input : run.outputs) {
+		std::sort(input.second.begin(), input.second.end());
+	}
+}
+
+// The outputs of every input are listed next to them so that missing and additional outputs are found. Each input is
+// on its own line followed by its outputs indented by a tab
+void updateReference(const FormatRun& run, const std::string& outputFolder, const std::string& referenceFolder)
+{
+	createFolders(referenceFolder);
+	std::string manifest;
+	for (const auto& input : run.outputs) {
+		manifest += input.first + "\n";
+		for (const std::string& output : input.second) {
+			std::string folder = folderOf(output);
+			if (!folder.empty())
+				createFolders(referenceFolder + "/" + folder);
+			writeFile(referenceFolder + "/" + output, readFile(outputFolder + "/" + output));
+			manifest += "\t" + output + "\n";
+		}
+	}
+	writeFile(referenceFolder + "/outputs.txt", manifest);
+}
+
+// Only inputs in the reference are checked, e.g. a reference of the sample assets does not cover the generated corpus
+void checkReference(FormatRun& run, const std::string& outputFolder, const std::string& referenceFolder, double tolerance)
+{
+	std::map<std::string, std::vector<std::string>> expected;
+	std::istringstream manifest{ readFile(referenceFolder + "/outputs.txt") };
+	std::vector<std::string>* inputOutputs = nullptr;
+	std::string line;
+	while (std::getline(manifest, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty())
+			continue;
+		if (line[0] != '\t')
+			inputOutputs = &expected[line];
+		else if (inputOutputs)
+			inputOutputs->push_back(line.substr(1));
+	}
+
+	std::vector<std::string> unchecked;
+	for (const auto& input : run.outputs) {
+		auto found = expected.find(input.first);
+		if (found == expected.end()) {
+			unchecked.push_back(input.first);
+			continue;
+		}
+		std::vector<std::string>& expectedOutputs = found->second;
+		std::sort(expectedOutputs.begin(), expectedOutputs.end());
+		for (const std::string& output : input.second) {
+			if (!std::binary_search(expectedOutputs.begin(), expectedOutputs.end(), output))
+				run.errors.push_back(output + ": not in the reference");
+		}
+		for (const std::string& output : expectedOutputs) {
+			if (!std::binary_search(input.second.begin(), input.second.end(), output)) {
+				run.errors.push_back(output + ": not written");
+				continue;
+			}
+			std::string difference = compareOutputs(output, readFile(outputFolder + "/" + output), readFile(referenceFolder + "/" + output), tolerance);
+			if (!difference.empty())
+				run.errors.push_back(output + ": " + difference);
+		}
+	}
+	if (!unchecked.empty()) {
+		std::string names;
+		for (const std::string& input : unchecked) {
+			names += (names.empty() ? "" : ", ") + input;
+		}
+		run.notes.push_back("not in the reference, outputs not checked: " + names);
+	}
+}
+
+void writeBaseline(const std::vector<FormatRun>& runs, const std::string& filename)
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer{ buffer };
+	writer.StartObject();
+	writer.Key("version");
+	writer.Uint(2);
+	writer.Key("runs");
+	writer.StartObject();
+	for (const FormatRun& run : runs) {
+		if (!run.errors.empty())
+			continue;
+		writer.Key(run.name().c_str());
+		writer.StartObject();
+		writer.Key("seconds");
+		writer.Double(run.seconds);
+		writer.Key("peakRssMB");
+		writer.Double(run.peakRss / 1048576.0);
+		writer.Key("inputBytes");
+		writer.Uint64(run.inputBytes);
+		writer.Key("outputBytes");
+		writer.Uint64(run.outputBytes);
+		writer.EndObject();
+	}
+	writer.EndObject();
+	writer.EndObject();
+	writeFile(filename, std::string(buffer.GetString(), buffer.GetSize()) + "\n");
+}
+
+rapidjson::Document readBaseline(const std::string& filename)
+{
+	std::string text = readFile(filename);
+	rapidjson::Document baseline;
+	baseline.Parse(text.c_str(), text.size());
+	if (baseline.HasParseError() || !baseline.IsObject() || !baseline.HasMember("runs") || !baseline["runs"].IsObject())
+		throw std::runtime_error("Baseline file " + filename + " is not valid");
+	if (!baseline.HasMember("version") || !baseline["version"].IsNumber() || baseline["version"].GetDouble() != 2)
+		throw std::runtime_error("Baseline file " + filename + " was written by another version, store a new one with -u");
+	return baseline;
+}
+
+//Smaller changes are noise of runs that take milliseconds and a few MB
+const double minRegressionSeconds = 0.05;
+const double minRegressionMB = 16.0;
+
+// Returns false if an output differs or a format got slower or needs more memory than the baseline allows
+bool printReport(const std::vector<FormatRun>& runs, const rapidjson::Document& baseline, double threshold)
+{
+	bool passed = true;
+	std::cout << std::endl << std::left << std::setw(16) << "run" << std::right << std::setw(7) << "files" << std::setw(11) << "input MB"
+		<< std::setw(11) << "output MB" << std::setw(9) << "s" << std::setw(9) << "MB/s" << std::setw(10) << "peak MB"
+		<< std::setw(10) << "time" << std::setw(10) << "memory" << std::endl;
+	for (const FormatRun& run : runs) {
+		double inputMB = run.inputBytes / 1048576.0;
+		double peakMB = run.peakRss / 1048576.0;
+		std::cout << std::left << std::setw(16) << run.name() << std::right << std::setw(7) << run.inputs.size() << std::fixed << std::setprecision(2)
+			<< std::setw(11) << inputMB << std::setw(11) << run.outputBytes / 1048576.0 << std::setprecision(3) << std::setw(9) << run.seconds
+			<< std::setprecision(2) << std::setw(9) << (run.seconds > 0.0 ? inputMB / run.seconds : 0.0) << std::setw(10) << peakMB;
+
+		//Changes against the baseline in percent, positive is slower or larger
+		std::string regression;
+		if (baseline.IsObject() && baseline["runs"].HasMember(run.name().c_str())) {
+			const rapidjson::Value& previous = baseline["runs"][run.name().c_str()];
+			double previousSeconds = previous["seconds"].GetDouble();
+			double previousMB = previous["peakRssMB"].GetDouble();
+			double timeChange = 100.0 * (run.seconds / previousSeconds - 1.0);
+			double memoryChange = 100.0 * (peakMB / previousMB - 1.0);
+			std::cout << std::showpos << std::setprecision(1) << std::setw(9) << timeChange << "%" << std::setw(9) << memoryChange << "%" << std::noshowpos;
+			if (previous["inputBytes"].GetUint64() != run.inputBytes)
+				regression = "corpus differs from the baseline";
+			else if (timeChange > threshold && run.seconds - previousSeconds > minRegressionSeconds)
+				regression = "slower than the baseline";
+			else if (memoryChange > threshold && peakMB - previousMB > minRegressionMB)
+				regression = "needs more memory than the baseline";
+		}
+		std::cout << std::endl;
+		if (!regression.empty()) {
+			std::cout << "  " << regression << std::endl;
+			passed = false;
+		}
+		for (const std::string& error : run.errors) {
+			std::cout << "  " << error << std::endl;
+			passed = false;
+		}
+		for (const std::string& note : run.notes) {
+			std::cout << "  note: " << note << std::endl;
+		}
+	}
+	std::cout << (passed ? "passed" : "FAILED") << std::endl;
+	return passed;
+}
+
+std::string readFile(const std::string& filename)
+{
+	std::ifstream file{ filename, std::ifstream::in | std::ifstream::binary };
+	if (!file.good())
+		throw std::runtime_error("Can not read " + filename);
+	std::ostringstream data;
+	data << file.rdbuf();
+	return data.str();
+}
+
+void writeFile(const std::string& filename, const std::string& data)
+{
+	std::ofstream file{ filename, std::ofstream::out | std::ofstream::binary };
+	file.write(data.data(), data.size());
+	if (!file.good())
+		throw std::runtime_error("Can not write to " + filename);
+}
+
+size_t fileSize(const std::string& filename)
+{
+	std::ifstream file{ filename, std::ifstream::in | std::ifstream::binary | std::ifstream::ate };
+	if (!file.good())
+		throw std::runtime_error("Can not read " + filename);
+	return size_t(file.tellg());
+}
+
+std::string getExtension(const std::string& filename)
+{
+	size_t pos = filename.find_last_of('.');
+	return pos == std::string::npos ? "" : filename.substr(pos + 1);
+}
+
+std::string baseName(const std::string& filename)
+{
+	size_t begin = filename.find_last_of("/\\");
+	begin = begin == std::string::npos ? 0 : begin + 1;
+	return filename.substr(begin, filename.find_last_of('.') - begin);
+}
+
+// Name with extension but without the folder
+std::string fileName(const std::string& filename)
+{
+	size_t pos = filename.find_last_of("/\\");
+	return pos == std::string::npos ? filename : filename.substr(pos + 1);
+}
+
+// Folder including the trailing separator, empty if filename has none
+std::string folderOf(const std::string& filename)
+{
+	size_t pos = filename.find_last_of("/\\");
+	return pos == std::string::npos ? "" : filename.substr(0, pos + 1);
+}
+
+std::vector<std::string> splitArguments(const std::string& text)
+{
+	std::vector<std::string> arguments;
+	std::istringstream stream{ text };
+	std::string argument;
+	while (stream >> argument) {
+		arguments.push_back(argument);
+	}
+	return arguments;
+}
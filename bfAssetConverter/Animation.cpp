@@ -1,12 +1,17 @@
 #include "Animation.h"
 #include <sstream>
+#include <array>
+#include <cmath>
 #include <glm/gtc/matrix_transform.hpp>
+#include "NpzWriter.h"
+#include "Trace.h"
 
 using namespace Utils;
 
 Animation::Animation(std::istream& stream, const Skeleton& skeleton)
 	:skeleton(skeleton)
 {
+	Trace::Span span{ "Animation::Animation" };
 	readBinary(stream, &version);
 
 	readBinary(stream, &boneCount);
@@ -22,12 +27,14 @@ Animation::Animation(std::istream& stream, const Skeleton& skeleton)
 	}
 }
 
-void Animation::writeToCollada(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* root) const
+void Animation::writeToCollada(ConversionContext& context, rapidxml::xml_node<>* root) const
 {
-	skeleton.writeToCollada(doc, root);
+	Trace::Span span{ "Animation::writeToCollada" };
+	rapidxml::xml_document<>& doc = context.document();
+	skeleton.writeToCollada(context, root);
 
-	char* keyframes = allocateAndComputeKeyframes(doc);
-	char* interpolationValues = allocateAndFillInterpolation(doc);
+	char* keyframes = allocateAndComputeKeyframes(context);
+	char* interpolationValues = allocateAndFillInterpolation(context);
 
 	using namespace rapidxml;
 	xml_node<>* libraryAnimations = root->first_node("library_animations");
@@ -38,7 +45,7 @@ void Animation::writeToCollada(rapidxml::xml_document<>& doc, rapidxml::xml_node
 		setId(doc, anim, boneName + "_anim");
 		{
 			char* inputId = writeSourceNode(doc, anim, boneName + "_anim-input", keyframes, frameCount, Format::time);
-			char* matrixStream = allocateAndComputeMatrixStream(doc, it.positionStream, it.rotationStream);
+			char* matrixStream = allocateAndComputeMatrixStream(context, it.positionStream, it.rotationStream);
 			char* outputId = writeSourceNode(doc, anim, boneName + "_anim-output", matrixStream, frameCount, Format::transform);
 			char* interpolationId = writeSourceNode(doc, anim, boneName + "_anim-interpolation", interpolationValues, frameCount, Format::interpolation);
 
@@ -72,8 +79,152 @@ void Animation::writeToCollada(rapidxml::xml_document<>& doc, rapidxml::xml_node
 	}
 }
 
+void Animation::writePoseCache(std::ostream& stream) const
+{
+	std::vector<glm::mat4> poses = computeModelSpacePoses();
+	uint32_t skeletonBoneCount = static_cast<uint32_t>(skeleton.bones.size());
+
+	stream.write("BFPC", 4);
+	writeBinary(stream, uint32_t(1));	//cache version
+	writeBinary(stream, skeletonBoneCount);
+	writeBinary(stream, frameCount);
+
+	std::vector<float> frameData(skeletonBoneCount * 12);
+	for (size_t frame = 0; frame < frameCount; ++frame) {
+		for (size_t bone = 0; bone < skeletonBoneCount; ++bone) {
+			const glm::mat4& mat = poses[bone * frameCount + frame];
+			for (int column = 0; column < 4; ++column) {	//last row is always 0 0 0 1
+				frameData[bone * 12 + column * 3 + 0] = mat[column][0];
+				frameData[bone * 12 + column * 3 + 1] = mat[column][1];
+				frameData[bone * 12 + column * 3 + 2] = mat[column][2];
+			}
+		}
+		writeBinaryArray(stream, frameData.data(), frameData.size());
+	}
+}
+
+void Animation::writeClip(std::ostream& stream) const
+{
+	constexpr float constantThreshold = 1e-5f;
+
+	stream.write("BFCL", 4);
+	writeBinary(stream, uint32_t(1));	//clip version
+	writeBinary(stream, boneCount);
+	writeBinary(stream, frameCount);
+
+	std::vector<std::array<std::vector<float>, 7>> animatedTracks;
+	for (const BoneData& it : boneAnimations) {
+		std::array<std::vector<float>, 7> tracks;
+		glm::quat previous = it.rotationStream.empty() ? glm::quat() : it.rotationStream[0];
+		for (size_t frame = 0; frame < frameCount; ++frame) {
+			glm::quat rot = it.rotationStream[frame];
+			if (glm::dot(rot, previous) < 0.0f)	//stay in one hemisphere so interpolation takes the short path
+				rot = -rot;
+			previous = rot;
+
+			tracks[0].push_back(rot.x);
+			tracks[1].push_back(rot.y);
+			tracks[2].push_back(rot.z);
+			tracks[3].push_back(rot.w);
+			tracks[4].push_back(it.positionStream[frame].x);
+			tracks[5].push_back(it.positionStream[frame].y);
+			tracks[6].push_back(it.positionStream[frame].z);
+		}
+
+		uint8_t animatedMask = 0;
+		std::array<std::pair<float, float>, 7> ranges;
+		for (size_t track = 0; track < tracks.size(); ++track) {
+			float min = 0.0f, max = 0.0f;
+			if (!tracks[track].empty()) {
+				auto minMax = std::minmax_element(tracks[track].begin(), tracks[track].end());
+				min = *minMax.first;
+				max = *minMax.second;
+			}
+			ranges[track] = std::make_pair(min, max - min);
+			if (max - min > constantThreshold)
+				animatedMask |= 1 << track;
+			else
+				ranges[track].second = 0.0f;
+		}
+
+		writeBinary(stream, it.boneId);
+		writeBinary(stream, animatedMask);
+		for (size_t track = 0; track < tracks.size(); ++track) {
+			writeBinary(stream, ranges[track].first);
+			if (animatedMask & (1 << track)) {	//range reduction to [0, 1]
+				writeBinary(stream, ranges[track].second);
+				for (float& value : tracks[track]) {
+					value = (value - ranges[track].first) / ranges[track].second;
+				}
+			}
+		}
+
+		for (size_t track = 0; track < tracks.size(); ++track) {
+			if (!(animatedMask & (1 << track)))
+				tracks[track].clear();
+		}
+		animatedTracks.push_back(std::move(tracks));
+	}
+
+	std::vector<uint16_t> record;
+	for (size_t frame = 0; frame < frameCount; ++frame) {
+		record.clear();
+		for (const std::array<std::vector<float>, 7>& tracks : animatedTracks) {
+			for (const std::vector<float>& track : tracks) {
+				if (!track.empty())
+					record.push_back(static_cast<uint16_t>(std::round(std::min(std::max(track[frame], 0.0f), 1.0f) * 65535.0f)));
+			}
+		}
+		writeBinaryArray(stream, record.data(), record.size());
+	}
+}
+
+std::vector<glm::mat4> Animation::computeModelSpacePoses() const
+{
+	size_t skeletonBoneCount = skeleton.bones.size();
+	std::vector<const BoneData*> animatedBones(skeletonBoneCount, nullptr);
+	for (const BoneData& it : boneAnimations) {
+		if (it.boneId >= skeletonBoneCount)
+			throw ConversionError("Animation references bone " + std::to_string(it.boneId) + " which is not in the skeleton");
+		animatedBones[it.boneId] = &it;
+	}
+	for (size_t bone = 0; bone < skeletonBoneCount; ++bone) {
+		if (skeleton.bones[bone].parent >= static_cast<int>(bone))
+			throw ConversionError("Skeleton bone " + skeleton.bones[bone].name + " is stored before its parent");
+	}
+
+	std::vector<glm::mat4> poses(skeletonBoneCount * frameCount);
+	parallelFor(frameCount, [&](size_t firstFrame, size_t lastFrame) {
+		for (size_t bone = 0; bone < skeletonBoneCount; ++bone) {	//Parents are always before children
+			const Skeleton::Bone& skeletonBone = skeleton.bones[bone];
+			const BoneData* animated = animatedBones[bone];
+			glm::mat4* track = &poses[bone * frameCount];
+			const glm::mat4* parentTrack = skeletonBone.parent == -1 ? nullptr : &poses[skeletonBone.parent * frameCount];
+
+			glm::mat4 bindPose = glm::translate(glm::mat4(), skeletonBone.position) * glm::mat4_cast(skeletonBone.rotation);
+			for (size_t frame = firstFrame; frame < lastFrame; ++frame) {
+				glm::mat4 local = animated
+					? glm::translate(glm::mat4(), animated->positionStream[frame]) * glm::mat4_cast(animated->rotationStream[frame])
+					: bindPose;
+				track[frame] = parentTrack ? parentTrack[frame] * local : local;
+			}
+		}
+	});
+	return poses;
+}
+
+size_t Animation::memoryUsage() const
+{
+	size_t size = sizeof(Animation) + boneAnimations.capacity() * sizeof(BoneData);
+	for (const BoneData& bone : boneAnimations) {
+		size += bone.rotationStream.capacity() * sizeof(glm::quat) + bone.positionStream.capacity() * sizeof(glm::vec3);
+	}
+	return size;
+}
+
 Animation::BoneData Animation::readBoneData(std::istream& stream, uint16_t boneId) const
 {
+	Trace::Span span{ "Animation::readBoneData" };
 	BoneData result;
 	result.boneId = boneId;
 	uint16_t datasize;
@@ -134,44 +285,89 @@ Animation::BoneData Animation::readBoneData(std::istream& stream, uint16_t boneI
 	return result;
 }
 
-char* Animation::allocateAndComputeMatrixStream(rapidxml::xml_document<>& doc, const std::vector<glm::vec3>& positionStream, const std::vector<glm::quat>& rotationStream) const
+void Animation::writeArrays(const std::string& baseName, OutputSink& sink) const
+{
+	std::vector<float> positions;
+	std::vector<float> rotations;
+	std::vector<uint16_t> boneIds;
+	positions.reserve(size_t(boneAnimations.size()) * frameCount * 3);
+	rotations.reserve(size_t(boneAnimations.size()) * frameCount * 4);
+	for (const BoneData& bone : boneAnimations) {
+		if (bone.boneId >= skeleton.bones.size())
+			throw ConversionError("Animation references bone " + std::to_string(bone.boneId) + " which is not in the skeleton");
+		if (bone.positionStream.size() != frameCount || bone.rotationStream.size() != frameCount)
+			throw ConversionError("Animation streams do not match the frame count");
+		boneIds.push_back(bone.boneId);
+		for (const glm::vec3& position : bone.positionStream) {
+			positions.insert(positions.end(), { position.x, position.y, position.z });
+		}
+		for (const glm::quat& rotation : bone.rotationStream) {
+			rotations.insert(rotations.end(), { rotation.x, rotation.y, rotation.z, rotation.w });
+		}
+	}
+
+	NpzWriter npz;
+	npz.add("bones", boneIds.data(), { boneIds.size() });
+	npz.add("positions", positions.data(), { boneIds.size(), frameCount, 3 });
+	npz.add("rotations", rotations.data(), { boneIds.size(), frameCount, 4 });
+
+	rapidjson::StringBuffer json;
+	rapidjson::Writer<rapidjson::StringBuffer> writer{ json };
+	writer.StartObject();
+	writer.Key("version");
+	writer.Uint(version);
+	writer.Key("frameCount");
+	writer.Uint(frameCount);
+	writer.Key("frameRate");
+	writer.Uint(15);
+	writer.Key("rotationOrder");
+	writer.String("xyzw");
+	writer.Key("bones");
+	writer.StartArray();
+	for (uint16_t boneId : boneIds) {
+		writer.String(skeleton.bones[boneId].name.c_str());
+	}
+	writer.EndArray();
+	writer.Key("arrays");
+	npz.writeIndex(writer);
+	writer.EndObject();
+
+	sink.write(baseName + ".npz", [&npz](std::ostream& output) { npz.write(output); });
+	sink.write(baseName + ".json", [&json](std::ostream& output) { output.write(json.GetString(), json.GetSize()); });
+}
+
+char* Animation::allocateAndComputeMatrixStream(ConversionContext& context, const std::vector<glm::vec3>& positionStream, const std::vector<glm::quat>& rotationStream) const
 {
-	std::stringstream ss;
+	std::string& text = context.text();
 	for (size_t i = 0; i < positionStream.size(); ++i) {
 		glm::mat4 localMat = glm::translate(glm::mat4(), positionStream[i]) * glm::mat4_cast(rotationStream[i]);
-		writeMatrixToStream(ss, localMat);
+		appendMatrix(text, localMat);
 	}
 
-	std::string result = ss.str();
-	result.pop_back();
-	return doc.allocate_string(result.c_str(), result.length() + 1);
+	return allocateText(context.document(), text);
 }
 
-char* Animation::allocateAndComputeKeyframes(rapidxml::xml_document<>& doc) const
+char* Animation::allocateAndComputeKeyframes(ConversionContext& context) const
 {
-	std::stringstream ss;
+	std::string& text = context.text();
 	constexpr float dt = 1.0f/15.0f;
 	float time = 0.0f;
 
 	for (size_t i = 0; i < frameCount; ++i) {
-		ss << time << " ";
+		appendFloat(text, time);
 		time += dt;
 	}
 
-	std::string result = ss.str();
-	result.pop_back();
-	return doc.allocate_string(result.c_str(), result.length() +1);
+	return allocateText(context.document(), text);
 }
 
-char* Animation::allocateAndFillInterpolation(rapidxml::xml_document<>& doc) const
+char* Animation::allocateAndFillInterpolation(ConversionContext& context) const
 {
-	std::stringstream ss;
+	std::string& text = context.text();
 
 	for (size_t i = 0; i < frameCount; ++i) {
-		ss << "LINEAR ";
+		text.append("LINEAR ");
 	}
 
-	std::string result = ss.str();
-	result.pop_back();
-	return doc.allocate_string(result.c_str(), result.length() +1);
+	return allocateText(context.document(), text);
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include "Skeleton.h"
+#include "OutputSink.h"
 
 class Animation
 {
@@ -7,7 +8,18 @@ public:
 	Animation(std::istream& stream, const Skeleton& skeleton);
 	~Animation() = default;
 
-	void writeToCollada(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* root) const;
+	void writeToCollada(ConversionContext& context, rapidxml::xml_node<>* root) const;
+	void writePoseCache(std::ostream& stream) const;
+	// Quantized random access clip, read back with AnimationClip
+	void writeClip(std::ostream& stream) const;
+	// Position and rotation streams of the animated bones as .npz with a .json sidecar
+	void writeArrays(const std::string& baseName, OutputSink& sink) const;
+
+	// Model space transforms of all skeleton bones for every frame, indexed [bone * frameCount + frame]
+	std::vector<glm::mat4> computeModelSpacePoses() const;
+	uint32_t getFrameCount() const { return frameCount; }
+	// Bytes held by the decoded streams
+	size_t memoryUsage() const;
 
 private:
 	struct BoneFrame {
@@ -21,9 +33,9 @@ private:
 	};
 
 	BoneData readBoneData(std::istream& stream, uint16_t boneId) const;
-	char* allocateAndComputeMatrixStream(rapidxml::xml_document<>& doc, const std::vector<glm::vec3>& positionStream, const std::vector<glm::quat>& rotationStream) const;
-	char* allocateAndComputeKeyframes(rapidxml::xml_document<>& doc) const;
-	char* allocateAndFillInterpolation(rapidxml::xml_document<>& doc) const;
+	char* allocateAndComputeMatrixStream(ConversionContext& context, const std::vector<glm::vec3>& positionStream, const std::vector<glm::quat>& rotationStream) const;
+	char* allocateAndComputeKeyframes(ConversionContext& context) const;
+	char* allocateAndFillInterpolation(ConversionContext& context) const;
 
 	const Skeleton& skeleton;
 	uint32_t version;
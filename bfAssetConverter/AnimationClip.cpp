@@ -0,0 +1,97 @@
+#include "AnimationClip.h"
+#include <cmath>
+
+using namespace Utils;
+
+constexpr float AnimationClip::frameRate;
+constexpr size_t AnimationClip::trackCount;
+
+AnimationClip::AnimationClip(std::istream& stream)
+{
+	char magic[4];
+	readBinaryArray(stream, magic, 4);
+	if (std::string(magic, 4) != "BFCL")
+		throw ConversionError("Not an animation clip");
+	uint32_t version;
+	readBinary(stream, &version);
+	if (version != 1)
+		throw ConversionError("Version is not supported");
+
+	uint16_t boneCount;
+	readBinary(stream, &boneCount);
+	readBinary(stream, &frameCount);
+
+	bones.resize(boneCount);
+	animatedTrackCount = 0;
+	for (BoneTracks& bone : bones) {
+		readBinary(stream, &bone.boneId);
+		readBinary(stream, &bone.animatedMask);
+		for (size_t track = 0; track < trackCount; ++track) {
+			readBinary(stream, &bone.tracks[track].min);
+			bone.tracks[track].range = 0.0f;
+			if (bone.animatedMask & (1 << track)) {
+				readBinary(stream, &bone.tracks[track].range);
+				bone.columns[track] = static_cast<uint16_t>(animatedTrackCount++);
+			}
+		}
+	}
+
+	frameData.resize(static_cast<size_t>(frameCount) * animatedTrackCount);
+	readBinaryArray(stream, frameData.data(), frameData.size());
+	if (!stream)
+		throw ConversionError("Unexpected end of clip");
+}
+
+void AnimationClip::sample(float time, std::vector<BonePose>& result) const
+{
+	if (frameCount == 0) {
+		result.clear();
+		return;
+	}
+
+	float position = std::max(0.0f, time * frameRate);
+	uint32_t frame0 = std::min(static_cast<uint32_t>(position), frameCount - 1);
+	uint32_t frame1 = std::min(frame0 + 1, frameCount - 1);
+	float t = frame0 == frame1 ? 0.0f : position - frame0;
+
+	result.resize(bones.size());
+	std::array<float, trackCount> values0, values1;
+	for (size_t i = 0; i < bones.size(); ++i) {
+		const BoneTracks& bone = bones[i];
+		decodeFrame(frame0, bone, values0);
+		decodeFrame(frame1, bone, values1);
+
+		glm::quat rot0{ values0[3], values0[0], values0[1], values0[2] };
+		glm::quat rot1{ values1[3], values1[0], values1[1], values1[2] };
+		result[i].boneId = bone.boneId;
+		result[i].rotation = glm::normalize(glm::slerp(rot0, rot1, t));
+		result[i].position = glm::mix(glm::vec3{ values0[4], values0[5], values0[6] }, glm::vec3{ values1[4], values1[5], values1[6] }, t);
+	}
+}
+
+void AnimationClip::sampleFrame(uint32_t frame, std::vector<BonePose>& result) const
+{
+	if (frame >= frameCount)
+		throw ConversionError("Frame " + std::to_string(frame) + " is out of range");
+
+	result.resize(bones.size());
+	std::array<float, trackCount> values;
+	for (size_t i = 0; i < bones.size(); ++i) {
+		decodeFrame(frame, bones[i], values);
+		result[i].boneId = bones[i].boneId;
+		result[i].rotation = glm::quat{ values[3], values[0], values[1], values[2] };
+		result[i].position = glm::vec3{ values[4], values[5], values[6] };
+	}
+}
+
+void AnimationClip::decodeFrame(uint32_t frame, const BoneTracks& bone, std::array<float, trackCount>& values) const
+{
+	const uint16_t* record = frameData.data() + static_cast<size_t>(frame) * animatedTrackCount;
+	for (size_t track = 0; track < trackCount; ++track) {
+		const Track& it = bone.tracks[track];
+		if (bone.animatedMask & (1 << track))
+			values[track] = it.min + record[bone.columns[track]] * (it.range / 65535.0f);
+		else
+			values[track] = it.min;
+	}
+}
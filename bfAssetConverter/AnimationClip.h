@@ -0,0 +1,47 @@
+#pragma once
+#include "Utils.h"
+#include <array>
+
+// Random access reader for clips written with Animation::writeClip
+class AnimationClip
+{
+public:
+	struct BonePose {
+		uint16_t boneId;
+		glm::quat rotation;
+		glm::vec3 position;
+	};
+
+	AnimationClip(std::istream& stream);
+	~AnimationClip() = default;
+
+	static constexpr float frameRate = 15.0f;
+	static constexpr size_t trackCount = 7;	//rotation xyzw, position xyz
+
+	// Local bone transforms at the given time in seconds, linearly interpolated between the two nearest frames
+	void sample(float time, std::vector<BonePose>& result) const;
+	void sampleFrame(uint32_t frame, std::vector<BonePose>& result) const;
+
+	float getDuration() const { return frameCount > 1 ? (frameCount - 1) / frameRate : 0.0f; }
+	uint32_t getFrameCount() const { return frameCount; }
+	size_t getBoneCount() const { return bones.size(); }
+
+private:
+	struct Track {
+		float min;
+		float range;	//0 for constant tracks
+	};
+	struct BoneTracks {
+		uint16_t boneId;
+		uint8_t animatedMask;	//bit n set if track n is animated
+		std::array<Track, trackCount> tracks;
+		std::array<uint16_t, trackCount> columns;	//position of animated tracks within a frame record
+	};
+
+	void decodeFrame(uint32_t frame, const BoneTracks& bone, std::array<float, trackCount>& values) const;
+
+	uint32_t frameCount;
+	uint32_t animatedTrackCount;
+	std::vector<BoneTracks> bones;
+	std::vector<uint16_t> frameData;	//frameCount records of animatedTrackCount quantized values
+};
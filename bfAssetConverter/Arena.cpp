@@ -0,0 +1,30 @@
+#include "Arena.h"
+#include <algorithm>
+#include <cstdint>
+#include "Utils.h"
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+	size_t padding = (alignment - reinterpret_cast<uintptr_t>(current) % alignment) % alignment;
+	if (!current || padding + size > remaining) {
+		//Large requests get a block of their own size, so they do not waste the rest of a regular block
+		size_t newSize = std::max(blockSize, size + alignment);
+		blocks.emplace_back(new char[newSize]);
+		current = blocks.back().get();
+		remaining = newSize;
+		padding = (alignment - reinterpret_cast<uintptr_t>(current) % alignment) % alignment;
+	}
+
+	char* result = current + padding;
+	current += padding + size;
+	remaining -= padding + size;
+	return result;
+}
+
+void* Arena::allocate(size_t count, size_t elementSize, size_t alignment)
+{
+	//allocate adds the alignment to the size of a new block
+	if (elementSize && count > (SIZE_MAX - alignment) / elementSize)
+		throw Utils::ConversionError("Can not allocate " + std::to_string(count) + " elements of " + std::to_string(elementSize) + " bytes");
+	return allocate(count * elementSize, alignment);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// Non owning view of characters, usually stored in an Arena
+struct StringRef {
+	const char* data = nullptr;
+	size_t size = 0;
+
+	std::string str() const { return std::string(data, size); }
+};
+
+// Non owning view of count elements, usually stored in an Arena
+template<typename T> struct Span {
+	T* data = nullptr;
+	size_t count = 0;
+
+	T* begin() const { return data; }
+	T* end() const { return data + count; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T& operator[](size_t i) const { return data[i]; }
+};
+
+// Monotonic allocator for data that lives as long as one parsed file. Memory is taken from large blocks
+// and only released, all at once, when the arena is destroyed. Destructors of stored objects are never run
+class Arena
+{
+public:
+	explicit Arena(size_t blockSize = 64 * 1024)
+		:blockSize(blockSize) {}
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t size, size_t alignment);
+	// Throws ConversionError if count elements of elementSize do not fit into the address space, counts come from files
+	void* allocate(size_t count, size_t elementSize, size_t alignment);
+
+	// Value initialized elements
+	template<typename T> Span<T> allocateArray(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+		T* data = static_cast<T*>(allocate(count, sizeof(T), alignof(T)));
+		for (size_t i = 0; i < count; ++i) {
+			new (data + i) T();
+		}
+		return Span<T>{ data, count };
+	}
+
+private:
+	std::vector<std::unique_ptr<char[]>> blocks;
+	char* current = nullptr;
+	size_t remaining = 0;
+	size_t blockSize;
+};
@@ -0,0 +1,163 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Lock free multi producer multi consumer queue with a fixed capacity (Dmitry Vyukov's bounded queue).
+// push and pop spin briefly and then sleep until the other side makes progress or the queue is closed
+template<typename T> class BoundedQueue
+{
+public:
+	// capacity is rounded up to a power of two
+	explicit BoundedQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity) {
+			size *= 2;
+		}
+		cells.reset(new Cell[size]);
+		mask = size - 1;
+		for (size_t i = 0; i < size; ++i) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		enqueuePos.store(0, std::memory_order_relaxed);
+		dequeuePos.store(0, std::memory_order_relaxed);
+	}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	// value is only moved from if the push succeeds
+	bool tryPush(T& value)
+	{
+		size_t pos = enqueuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell& cell = cells[pos & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+			if (diff == 0) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell.value = std::move(value);
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0) {
+				return false;	//full
+			}
+			else {
+				pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool tryPop(T& value)
+	{
+		size_t pos = dequeuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell& cell = cells[pos & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(sequence) - intptr_t(pos + 1);
+			if (diff == 0) {
+				if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					value = std::move(cell.value);
+					cell.sequence.store(pos + mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0) {
+				return false;	//empty
+			}
+			else {
+				pos = dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Waits until there is room
+	void push(T value)
+	{
+		if (!spin([&]() { return tryPush(value); })) {
+			std::unique_lock<std::mutex> lock{ mutex };
+			++pushWaiting;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			while (!tryPush(value)) {
+				notFull.wait(lock);
+			}
+			--pushWaiting;
+		}
+		wake(popWaiting, notEmpty);
+	}
+
+	// Waits until there is a value, returns false once the queue is closed and empty
+	bool pop(T& value)
+	{
+		if (!spin([&]() { return tryPop(value); })) {
+			std::unique_lock<std::mutex> lock{ mutex };
+			++popWaiting;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			while (!tryPop(value)) {
+				if (closed) {
+					--popWaiting;
+					return false;
+				}
+				notEmpty.wait(lock);
+			}
+			--popWaiting;
+		}
+		wake(pushWaiting, notFull);
+		return true;
+	}
+
+	// Called once all producers are finished, wakes the waiting consumers
+	void close()
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+		closed = true;
+		notEmpty.notify_all();
+	}
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	template<typename Func> static bool spin(Func attempt)
+	{
+		for (int i = 0; i < 16; ++i) {
+			if (attempt())
+				return true;
+			std::this_thread::yield();
+		}
+		return false;
+	}
+
+	// The fences in here and after registering a waiter make sure that either the waiter sees the change or this sees the waiter
+	void wake(const std::atomic<unsigned>& waiting, std::condition_variable& condition)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed) > 0) {
+			std::lock_guard<std::mutex> lock{ mutex };
+			condition.notify_one();
+		}
+	}
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+	//Producers and consumers write different cache lines
+	char padding0[64];
+	std::atomic<size_t> enqueuePos;
+	char padding1[64];
+	std::atomic<size_t> dequeuePos;
+	char padding2[64];
+	//Only used when a side has to wait
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+	std::atomic<unsigned> pushWaiting{ 0 };
+	std::atomic<unsigned> popWaiting{ 0 };
+	bool closed = false;
+};
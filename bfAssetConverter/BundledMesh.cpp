@@ -1,12 +1,14 @@
 #include "BundledMesh.h"
+#include "Trace.h"
 #include <string>
 
 using namespace Utils;
 using namespace rapidxml;
 
-BundledMesh::BundledMesh(std::istream& stream)
-	:Mesh(stream)
+BundledMesh::BundledMesh(std::istream& stream, bool streamBuffers)
+	:Mesh(stream, streamBuffers)
 {
+	Trace::Span span{ "BundledMesh::BundledMesh" };
 	stream.ignore(4);
 
 	//Lod data
@@ -24,9 +26,8 @@ BundledMesh::BundledMesh(std::istream& stream)
 	//Triangles
 	for (Geometry& geom : geometrys) {
 		for (Lod& lod : geom.lods) {
-			uint32_t materialCount;
-			readBinary(stream, &materialCount);
-			lod.materials.resize(materialCount);
+			uint32_t materialCount = readCount(stream, minMaterialBytes);
+			lod.materials = arena.allocateArray<Material>(materialCount);
 			for (Material& material : lod.materials) {
 				readBinary(stream, &material.alphamode);
 				readMaterial(stream, material);
@@ -38,8 +39,10 @@ BundledMesh::BundledMesh(std::istream& stream)
 	mirrorFix();
 }
 
-void BundledMesh::writeToCollada(xml_document<>& doc, xml_node<>* root, const Lod& lod) const
+void BundledMesh::writeToCollada(ConversionContext& context, xml_node<>* root, const Lod& lod) const
 {
+	Trace::Span span{ "BundledMesh::writeToCollada" };
+	xml_document<>& doc = context.document();
 	xml_node<>* libraryGeometries = root->first_node("library_geometries");
 	xml_node<>* libraryControllers = root->first_node("library_controllers");
 	xml_node<>* visualScene = root->first_node("library_visual_scenes")->first_node("visual_scene");
@@ -48,7 +51,7 @@ void BundledMesh::writeToCollada(xml_document<>& doc, xml_node<>* root, const Lo
 	for (size_t iMaterial = 0; iMaterial < lod.materials.size(); ++iMaterial) {
 		const Material& material = lod.materials[iMaterial];
 		std::string objectName = "Object_" + std::to_string(objectId);
-		char* meshId = writeGeometry(doc, libraryGeometries, objectName, material);
+		char* meshId = writeSharedGeometry(context, libraryGeometries, objectName, material);
 		writeSceneObject(doc, visualScene, objectName, meshId);
 		++objectId;
 	}
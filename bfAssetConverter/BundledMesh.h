@@ -4,10 +4,10 @@
 class BundledMesh : public Mesh
 {
 public:
-	BundledMesh(std::istream& stream);
+	BundledMesh(std::istream& stream, bool streamBuffers = false);
 	~BundledMesh() = default;
 
 protected:
-	void writeToCollada(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* root, const Lod& lod) const override;
+	void writeToCollada(ConversionContext& context, rapidxml::xml_node<>* root, const Lod& lod) const override;
 	void writeSceneObject(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* visualScene, const std::string& objectName, const char* geomId) const;
 };
@@ -1,16 +1,20 @@
 #include "CollisionMesh.h"
 #include <iostream>
 #include <sstream>
-#include <array>
+#include <cstring>
 #include <memory>
+#include <map>
 #include <fstream>
 #include <rapidxml/rapidxml_print.hpp>
+#include "NpzWriter.h"
+#include "Trace.h"
 
 using namespace Utils;
 using namespace rapidxml;
 
 CollisionMesh::CollisionMesh(std::istream& stream)
 {
+	Trace::Span span{ "CollisionMesh::CollisionMesh" };
 	stream.ignore(4);
 	readBinary(stream, &version);
 
@@ -22,87 +26,194 @@ CollisionMesh::CollisionMesh(std::istream& stream)
 	}
 }
 
-void CollisionMesh::writeFiles(const std::string& baseName) const
+void CollisionMesh::writeFiles(const std::string& baseName, OutputSink& sink, ConversionContext& context) const
 {
-	//8 is the maximum material
-	std::array<std::array<SimpleIndexedGeometry, 8>, 3> tmpGeometries;
-
+	//One bucket per used coltype and material, both come from the file and may be arbitrary
+	typedef std::map<std::pair<uint32_t, uint16_t>, std::vector<FaceRef>> BucketMap;
+	BucketMap bucketFaces;
 	for (const Geometry& geom : geometrys) {
 		for (const SubGeometry& sub : geom.subGeoms) {
 			for (const Lod& lod : sub.lods) {
 				for (const Face& face : lod.faces) {
-					//Reverse Vertices
-					tmpGeometries[lod.coltype][face.m].addVertex(lod.vertices[face.v3]);
-					tmpGeometries[lod.coltype][face.m].addVertex(lod.vertices[face.v2]);
-					tmpGeometries[lod.coltype][face.m].addVertex(lod.vertices[face.v1]);
+					if (face.v1 >= lod.vertices.size() || face.v2 >= lod.vertices.size() || face.v3 >= lod.vertices.size())
+						throw ConversionError("Face references a vertex out of range");
+					bucketFaces[std::make_pair(lod.coltype, face.m)].push_back(FaceRef{ &lod, &face });
 				}
 			}
 		}
 	}
 
-	for (size_t type = 0; type < tmpGeometries.size(); ++type) {
+	std::vector<const BucketMap::value_type*> usedBuckets;
+	for (const auto& bucket : bucketFaces) {
+		usedBuckets.push_back(&bucket);
+	}
+
+	std::vector<SimpleIndexedGeometry> tmpGeometries(usedBuckets.size());
+	parallelFor(usedBuckets.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			SimpleIndexedGeometry& geometry = tmpGeometries[i];
+			const std::vector<FaceRef>& faces = usedBuckets[i]->second;
+			geometry.reserve(faces.size() * 3);
+			for (const FaceRef& ref : faces) {
+				//Reverse Vertices
+				geometry.addVertex(ref.lod->vertices[ref.face->v3]);
+				geometry.addVertex(ref.lod->vertices[ref.face->v2]);
+				geometry.addVertex(ref.lod->vertices[ref.face->v1]);
+			}
+		}
+	});
+
+	for (size_t i = 0; i < usedBuckets.size(); ++i) {
+		uint32_t type = usedBuckets[i]->first.first;
+		uint16_t material = usedBuckets[i]->first.second;
 		std::string name;
 		switch (type)
 		{
 		case 0: name = baseName + "_projectile_material";	break;
 		case 1: name = baseName + "_vehicle_material";		break;
 		case 2: name = baseName + "_soldier_material";		break;
+		default: name = baseName + "_coltype" + std::to_string(type) + "_material";	break;
+		}
+
+		WriteSimpleGeometry(name + std::to_string(material) + ".dae", tmpGeometries[i], sink, context);
+	}
+}
+
+void CollisionMesh::writeArrays(const std::string& baseName, OutputSink& sink) const
+{
+	NpzWriter npz;
+	rapidjson::StringBuffer json;
+	rapidjson::Writer<rapidjson::StringBuffer> writer{ json };
+	writer.StartObject();
+	writer.Key("version");
+	writer.Uint(version);
+	writer.Key("lods");
+	writer.StartArray();
+	for (uint32_t geom = 0; geom < geometrys.size(); ++geom) {
+		for (uint32_t sub = 0; sub < geometrys[geom].subGeoms.size(); ++sub) {
+			const SubGeometry& subGeom = geometrys[geom].subGeoms[sub];
+			for (uint32_t iLod = 0; iLod < subGeom.lods.size(); ++iLod) {
+				const Lod& lod = subGeom.lods[iLod];
+				std::string name = "geom" + std::to_string(geom) + "_sub" + std::to_string(sub) + "_lod" + std::to_string(iLod);
+
+				std::vector<uint16_t> triangles;
+				std::vector<uint16_t> materials;
+				triangles.reserve(lod.faces.size() * 3);
+				materials.reserve(lod.faces.size());
+				for (const Face& face : lod.faces) {
+					if (face.v1 >= lod.vertices.size() || face.v2 >= lod.vertices.size() || face.v3 >= lod.vertices.size())
+						throw ConversionError("Face references a vertex out of range");
+					//Reverse Vertices
+					triangles.insert(triangles.end(), { face.v3, face.v2, face.v1 });
+					materials.push_back(face.m);
+				}
+				npz.add(name + "_vertices", reinterpret_cast<const float*>(lod.vertices.data()), { lod.vertices.size(), 3 });
+				npz.add(name + "_triangles", triangles.data(), { lod.faces.size(), 3 });
+				npz.add(name + "_materials", materials.data(), { lod.faces.size() });
+
+				writer.StartObject();
+				writer.Key("name");
+				writer.String(name.c_str());
+				writer.Key("geometry");
+				writer.Uint(geom);
+				writer.Key("subGeometry");
+				writer.Uint(sub);
+				writer.Key("lod");
+				writer.Uint(iLod);
+				writer.Key("coltype");
+				writer.Uint(lod.coltype);
+				writer.EndObject();
+			}
+		}
+	}
+	writer.EndArray();
+	writer.Key("arrays");
+	npz.writeIndex(writer);
+	writer.EndObject();
+
+	sink.write(baseName + ".npz", [&npz](std::ostream& output) { npz.write(output); });
+	sink.write(baseName + ".json", [&json](std::ostream& output) { output.write(json.GetString(), json.GetSize()); });
+}
+
+void CollisionMesh::writeAccelerationData(std::ostream& stream) const
+{
+	uint32_t lodCount = 0;
+	for (const Geometry& geom : geometrys) {
+		for (const SubGeometry& sub : geom.subGeoms) {
+			lodCount += static_cast<uint32_t>(sub.lods.size());
 		}
+	}
 
-		for (size_t material = 0; material < tmpGeometries[type].size(); ++material) {
-			if (!tmpGeometries[type][material].indices.empty()) {
-				WriteSimpleGeometry(name + std::to_string(material) + ".dae", tmpGeometries[type][material]);
+	stream.write("BFCA", 4);
+	writeBinary(stream, uint32_t(1));	//export version
+	writeBinary(stream, version);
+	writeBinary(stream, lodCount);
+	for (uint32_t geom = 0; geom < geometrys.size(); ++geom) {
+		for (uint32_t sub = 0; sub < geometrys[geom].subGeoms.size(); ++sub) {
+			const SubGeometry& subGeom = geometrys[geom].subGeoms[sub];
+			for (uint32_t iLod = 0; iLod < subGeom.lods.size(); ++iLod) {
+				const Lod& lod = subGeom.lods[iLod];
+				writeBinary(stream, geom);
+				writeBinary(stream, sub);
+				writeBinary(stream, iLod);
+				writeBinary(stream, lod.coltype);
+				writeBinary(stream, lod.bmin);
+				writeBinary(stream, lod.bmax);
+				writeBinary(stream, static_cast<uint32_t>(lod.treeNodes.size()));
+				writeBinaryArray(stream, lod.treeNodes.data(), lod.treeNodes.size());
+				writeBinary(stream, static_cast<uint32_t>(lod.treeFaces.size()));
+				writeBinaryArray(stream, lod.treeFaces.data(), lod.treeFaces.size());
+				writeBinary(stream, static_cast<uint32_t>(lod.treeExtra.size()));
+				writeBinaryArray(stream, lod.treeExtra.data(), lod.treeExtra.size());
 			}
 		}
 	}
 }
 
-void CollisionMesh::WriteSimpleGeometry(const std::string& name, const SimpleIndexedGeometry& geometry) const
+void CollisionMesh::WriteSimpleGeometry(const std::string& name, const SimpleIndexedGeometry& geometry, OutputSink& sink, ConversionContext& context) const
 {
-	auto doc = std::make_unique<rapidxml::xml_document<>>();
-	xml_node<>* root = Utils::createColladaFramework(*doc);
+	xml_document<>& doc = context.newDocument();
+	xml_node<>* root = Utils::createColladaFramework(doc);
 	
-	xml_node<>* geometryNode = doc->allocate_node(node_element, "geometry");
-	char* meshId = setId(*doc, geometryNode, "Object-mesh");
+	xml_node<>* geometryNode = doc.allocate_node(node_element, "geometry");
+	char* meshId = setId(doc, geometryNode, "Object-mesh");
 	{
-		xml_node<>* mesh = doc->allocate_node(node_element, "mesh");
+		xml_node<>* mesh = doc.allocate_node(node_element, "mesh");
 		{
-			char* positionData = Utils::floatsToString(*doc, geometry.vertices);
-			char* positionsId = writeSourceNode(*doc, mesh, "Object-mesh-positions", positionData, geometry.vertices.size() / 3, Format::xyz);
+			char* positionData = Utils::floatsToString(context, geometry.vertices);
+			char* positionsId = writeSourceNode(doc, mesh, "Object-mesh-positions", positionData, geometry.vertices.size() / 3, Format::xyz);
 
-			xml_node<>* vertices = doc->allocate_node(node_element, "vertices");
-			char* verticesId = setId(*doc, vertices, "Object-mesh-vertices");
+			xml_node<>* vertices = doc.allocate_node(node_element, "vertices");
+			char* verticesId = setId(doc, vertices, "Object-mesh-vertices");
 			{
-				xml_node<>* input = doc->allocate_node(node_element, "input");
-				input->append_attribute(doc->allocate_attribute("semantic", "POSITION"));
-				input->append_attribute(doc->allocate_attribute("source", positionsId));
+				xml_node<>* input = doc.allocate_node(node_element, "input");
+				input->append_attribute(doc.allocate_attribute("semantic", "POSITION"));
+				input->append_attribute(doc.allocate_attribute("source", positionsId));
 				vertices->append_node(input);
 			}
 			mesh->append_node(vertices);
 
-			xml_node<>* polylist = doc->allocate_node(node_element, "polylist");
+			xml_node<>* polylist = doc.allocate_node(node_element, "polylist");
 			{
-				char* indexData = indicesToString(*doc, geometry.indices);
-				polylist->append_attribute(doc->allocate_attribute("count", doc->allocate_string(
+				char* indexData = indicesToString(context, geometry.indices);
+				polylist->append_attribute(doc.allocate_attribute("count", doc.allocate_string(
 					std::to_string(geometry.indices.size() / 3).c_str()
 				)));
 
-				xml_node<> *input = doc->allocate_node(node_element, "input");
-				input->append_attribute(doc->allocate_attribute("semantic", "VERTEX"));
-				input->append_attribute(doc->allocate_attribute("source", verticesId));
-				input->append_attribute(doc->allocate_attribute("offset", "0"));
+				xml_node<> *input = doc.allocate_node(node_element, "input");
+				input->append_attribute(doc.allocate_attribute("semantic", "VERTEX"));
+				input->append_attribute(doc.allocate_attribute("source", verticesId));
+				input->append_attribute(doc.allocate_attribute("offset", "0"));
 				polylist->append_node(input);
 
-				std::stringstream ss;
+				std::string& text = context.text();
 				for (size_t i = 0; i < geometry.indices.size() / 3; ++i) {
-					ss << "3 ";
+					text.append("3 ");
 				}
-				std::string result = ss.str();
-				result.pop_back();
-				char* vcountData = doc->allocate_string(result.c_str(), result.length() + 1);
+				char* vcountData = allocateText(doc, text);
 
-				polylist->append_node(doc->allocate_node(node_element, "vcount", vcountData));
-				polylist->append_node(doc->allocate_node(node_element, "p", indexData));
+				polylist->append_node(doc.allocate_node(node_element, "vcount", vcountData));
+				polylist->append_node(doc.allocate_node(node_element, "p", indexData));
 			}
 			mesh->append_node(polylist);
 		}
@@ -110,26 +221,22 @@ void CollisionMesh::WriteSimpleGeometry(const std::string& name, const SimpleInd
 	}
 	root->first_node("library_geometries")->append_node(geometryNode);
 	
-	xml_node<>* node = doc->allocate_node(node_element, "node");
+	xml_node<>* node = doc.allocate_node(node_element, "node");
 	{
-		char* id = setId(*doc, node, "Object");
-		node->append_attribute(doc->allocate_attribute("name", id + 1));
-		node->append_attribute(doc->allocate_attribute("type", "NODE"));
+		char* id = setId(doc, node, "Object");
+		node->append_attribute(doc.allocate_attribute("name", id + 1));
+		node->append_attribute(doc.allocate_attribute("type", "NODE"));
 
-		xml_node<>* instanceGeometry = doc->allocate_node(node_element, "instance_geometry");
+		xml_node<>* instanceGeometry = doc.allocate_node(node_element, "instance_geometry");
 		{
-			instanceGeometry->append_attribute(doc->allocate_attribute("url", meshId));
-			instanceGeometry->append_attribute(doc->allocate_attribute("name", id + 1));
+			instanceGeometry->append_attribute(doc.allocate_attribute("url", meshId));
+			instanceGeometry->append_attribute(doc.allocate_attribute("name", id + 1));
 		}
 		node->append_node(instanceGeometry);
 	}
 	root->first_node("library_visual_scenes")->first_node("visual_scene")->append_node(node);
 
-	std::ofstream output{ name };
-	if (!output.good())
-		throw Utils::ConversionError("Can not write to output file " + name);
-	output << *doc;
-	std::cout << "   -->" << name << std::endl;
+	sink.write(name, [&doc](std::ostream& output) { output << doc; });
 }
 
 void CollisionMesh::ReadGeometry(std::istream& stream, Geometry& geom) const
@@ -154,6 +261,7 @@ void CollisionMesh::ReadSubGeometry(std::istream& stream, SubGeometry& geom) con
 
 void CollisionMesh::ReadLod(std::istream& stream, Lod& lod) const
 {
+	lod.coltype = 0;
 	if (version >= 9)
 		readBinary(stream, &lod.coltype);
 
@@ -179,33 +287,83 @@ void CollisionMesh::ReadLod(std::istream& stream, Lod& lod) const
 	readBinary(stream, &lod.bmin);
 	readBinary(stream, &lod.bmax);
 
-	uint32_t unknownCount;
-	readBinary(stream, &unknownCount);
-	stream.ignore(unknownCount * 16);
+	uint32_t nodeCount;
+	readBinary(stream, &nodeCount);
+	lod.treeNodes.resize(nodeCount);
+	readBinaryArray(stream, lod.treeNodes.data(), nodeCount);
 
-	uint32_t unknownCount2;
-	readBinary(stream, &unknownCount2);
-	stream.ignore(unknownCount2 * 2);
+	uint32_t treeFaceCount;
+	readBinary(stream, &treeFaceCount);
+	lod.treeFaces.resize(treeFaceCount);
+	readBinaryArray(stream, lod.treeFaces.data(), treeFaceCount);
 
 	if (version >= 10) {
-		uint32_t unknownCount3;
-		readBinary(stream, &unknownCount3);
-		stream.ignore(unknownCount3 * 4);
+		uint32_t extraCount;
+		readBinary(stream, &extraCount);
+		lod.treeExtra.resize(extraCount);
+		readBinaryArray(stream, lod.treeExtra.data(), extraCount);
+	}
+	if (!stream)
+		throw ConversionError("Unexpected end of file");
+}
+
+void CollisionMesh::SimpleIndexedGeometry::reserve(size_t vertexCount)
+{
+	vertices.reserve(vertexCount * 3);
+	indices.reserve(vertexCount);
+	size_t slotCount = 16;
+	while (slotCount < vertexCount * 2) {
+		slotCount *= 2;
 	}
+	if (slotCount > slots.size())
+		rehash(slotCount);
 }
 
 void CollisionMesh::SimpleIndexedGeometry::addVertex(glm::vec3 vertex)
 {
-	auto ins = indexMap.insert(std::make_pair(vertex, vertices.size()));
-	if (ins.second) {
-		vertices.push_back(vertex.x);
-		vertices.push_back(vertex.y);
-		vertices.push_back(vertex.z);
+	if ((vertices.size() / 3 + 1) * 2 > slots.size())	//keep the load factor below 0.5
+		rehash(std::max<size_t>(16, slots.size() * 2));
+
+	size_t mask = slots.size() - 1;
+	for (size_t slot = hash(vertex) & mask;; slot = (slot + 1) & mask) {
+		uint32_t entry = slots[slot];
+		if (entry == 0) {
+			slots[slot] = static_cast<uint32_t>(vertices.size() / 3 + 1);
+			indices.push_back(vertices.size() / 3);
+			vertices.push_back(vertex.x);
+			vertices.push_back(vertex.y);
+			vertices.push_back(vertex.z);
+			return;
+		}
+		const float* existing = &vertices[(entry - 1) * 3];
+		if (existing[0] == vertex.x && existing[1] == vertex.y && existing[2] == vertex.z) {
+			indices.push_back(entry - 1);
+			return;
+		}
+	}
+}
+
+size_t CollisionMesh::SimpleIndexedGeometry::hash(const glm::vec3& vertex)
+{
+	uint64_t result = 0;
+	for (int i = 0; i < 3; ++i) {
+		float component = vertex[i] == 0.0f ? 0.0f : vertex[i];	//-0 and 0 compare equal
+		uint32_t bits;
+		memcpy(&bits, &component, sizeof(bits));
+		result = (result ^ bits) * 0x9E3779B97F4A7C15ull;
 	}
-	indices.push_back(ins.first->second / 3);
+	return static_cast<size_t>(result ^ (result >> 32));
 }
 
-bool std::operator<(const glm::vec3& lhs, const glm::vec3& rhs)
+void CollisionMesh::SimpleIndexedGeometry::rehash(size_t slotCount)
 {
-	return std::tie(lhs.x, lhs.y, lhs.z) < std::tie(rhs.x, rhs.y, rhs.z);
-}
\ No newline at end of file
+	slots.assign(slotCount, 0);
+	size_t mask = slotCount - 1;
+	for (size_t vertex = 0; vertex < vertices.size() / 3; ++vertex) {
+		size_t slot = hash(glm::vec3{ vertices[vertex * 3], vertices[vertex * 3 + 1], vertices[vertex * 3 + 2] }) & mask;
+		while (slots[slot] != 0) {
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = static_cast<uint32_t>(vertex + 1);
+	}
+}
@@ -1,17 +1,18 @@
 #pragma once
 #include "Utils.h"
-#include <map>
-
-namespace std {
-	bool operator<(const glm::vec3& lhs, const glm::vec3& rhs);
-}
+#include "OutputSink.h"
+#include "ConversionContext.h"
 
 class CollisionMesh
 {
 public:
 	CollisionMesh(std::istream& stream);
 
-	void writeFiles(const std::string& baseName) const;
+	void writeFiles(const std::string& baseName, OutputSink& sink, ConversionContext& context) const;
+	// Writes the vertices and faces of every lod as .npz with a .json sidecar
+	void writeArrays(const std::string& baseName, OutputSink& sink) const;
+	// Exports the precomputed tree and face lists of every lod
+	void writeAccelerationData(std::ostream& stream) const;
 
 protected:
 	struct Face {
@@ -20,6 +21,10 @@ protected:
 		uint16_t v3;
 		uint16_t m;
 	};
+	// The meaning of the single fields is not fully known, so nodes are kept as raw words
+	struct TreeNode {
+		uint32_t data[4];
+	};
 	struct Lod {
 		uint32_t coltype;
 		std::vector<Face> faces;
@@ -29,6 +34,9 @@ protected:
 		glm::vec3 max;
 		glm::vec3 bmin;
 		glm::vec3 bmax;
+		std::vector<TreeNode> treeNodes;
+		std::vector<uint16_t> treeFaces;	//face lists referenced by the tree
+		std::vector<uint32_t> treeExtra;	//version 10 and above
 	};
 	struct SubGeometry {
 		std::vector<Lod> lods;
@@ -37,15 +45,25 @@ protected:
 		std::vector<SubGeometry> subGeoms;
 	};
 
+	struct FaceRef {
+		const Lod* lod;
+		const Face* face;
+	};
+	// Welds identical positions through an open addressing hash table
 	struct SimpleIndexedGeometry {
 		std::vector<float> vertices;
 		std::vector<size_t> indices;
-		std::map<glm::vec3, size_t> indexMap;
+		std::vector<uint32_t> slots;	//vertex number + 1, 0 marks an empty slot
 
+		void reserve(size_t vertexCount);
 		void addVertex(glm::vec3 vertex);
+
+	private:
+		static size_t hash(const glm::vec3& vertex);
+		void rehash(size_t slotCount);
 	};
 
-	void WriteSimpleGeometry(const std::string& name, const SimpleIndexedGeometry& geometry) const;
+	void WriteSimpleGeometry(const std::string& name, const SimpleIndexedGeometry& geometry, OutputSink& sink, ConversionContext& context) const;
 
 	void ReadGeometry(std::istream& stream, Geometry& geom) const;
 	void ReadSubGeometry(std::istream& stream, SubGeometry& geom) const;
@@ -0,0 +1,359 @@
+#include "Compression.h"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <vector>
+#include <exception>
+#include "Utils.h"
+#include "Trace.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace Utils;
+
+namespace {
+	//Size of the pieces handed to the compressor, a few of them are in flight per output
+	const size_t chunkSize = 256 * 1024;
+	const size_t queuedChunks = 4;
+
+#ifdef HAVE_ZLIB
+	class GzipCompressor :public Compressor
+	{
+	public:
+		GzipCompressor(int level)
+		{
+			stream = {};
+			//15 + 16 writes a gzip header and trailer instead of a zlib one
+			if (deflateInit2(&stream, level ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+				throw ConversionError("Can not initialize gzip compression");
+		}
+		~GzipCompressor()
+		{
+			deflateEnd(&stream);
+		}
+
+		void compress(const char* data, size_t size, bool finish, std::string& output) override
+		{
+			stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+			stream.avail_in = static_cast<uInt>(size);
+			int result;
+			do {
+				size_t used = output.size();
+				output.resize(used + chunkSize);
+				stream.next_out = reinterpret_cast<Bytef*>(&output[used]);
+				stream.avail_out = static_cast<uInt>(chunkSize);
+				result = deflate(&stream, finish ? Z_FINISH : Z_NO_FLUSH);
+				if (result == Z_STREAM_ERROR)
+					throw ConversionError("gzip compression failed");
+				output.resize(output.size() - stream.avail_out);
+			} while (stream.avail_out == 0 || (finish && result != Z_STREAM_END));
+		}
+
+		const char* extension() const override { return ".gz"; }
+
+	private:
+		z_stream stream;
+	};
+#endif
+
+#ifdef HAVE_ZSTD
+	class ZstdCompressor :public Compressor
+	{
+	public:
+		ZstdCompressor(int level)
+			:context(ZSTD_createCCtx())
+		{
+			if (!context)
+				throw ConversionError("Can not initialize zstd compression");
+			ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level ? level : ZSTD_CLEVEL_DEFAULT);
+		}
+		~ZstdCompressor()
+		{
+			ZSTD_freeCCtx(context);
+		}
+
+		void compress(const char* data, size_t size, bool finish, std::string& output) override
+		{
+			ZSTD_inBuffer input{ data, size, 0 };
+			for (;;) {
+				size_t used = output.size();
+				output.resize(used + ZSTD_CStreamOutSize());
+				ZSTD_outBuffer buffer{ &output[used], ZSTD_CStreamOutSize(), 0 };
+				size_t remaining = ZSTD_compressStream2(context, &buffer, &input, finish ? ZSTD_e_end : ZSTD_e_continue);
+				if (ZSTD_isError(remaining))
+					throw ConversionError(std::string("zstd compression failed: ") + ZSTD_getErrorName(remaining));
+				output.resize(used + buffer.pos);
+				if (finish ? remaining == 0 : input.pos == input.size)
+					break;
+			}
+		}
+
+		const char* extension() const override { return ".zst"; }
+
+	private:
+		ZSTD_CCtx* context;
+	};
+#endif
+
+	// Hands chunks from the serializing thread to the compressing thread, push blocks while queuedChunks are waiting
+	class ChunkQueue
+	{
+	public:
+		void push(std::string chunk)
+		{
+			std::unique_lock<std::mutex> lock{ mutex };
+			changed.wait(lock, [this]() { return chunks.size() < queuedChunks || aborted; });
+			if (aborted)
+				return;	//the compressor failed, the rest of the output is dropped
+			chunks.push_back(std::move(chunk));
+			changed.notify_all();
+		}
+		// Returns false once the queue is closed and empty
+		bool pop(std::string& chunk)
+		{
+			std::unique_lock<std::mutex> lock{ mutex };
+			changed.wait(lock, [this]() { return !chunks.empty() || closed; });
+			if (chunks.empty())
+				return false;
+			chunk = std::move(chunks.front());
+			chunks.pop_front();
+			changed.notify_all();
+			return true;
+		}
+		void close()
+		{
+			std::lock_guard<std::mutex> lock{ mutex };
+			closed = true;
+			changed.notify_all();
+		}
+		void abort()
+		{
+			std::lock_guard<std::mutex> lock{ mutex };
+			aborted = true;
+			chunks.clear();
+			changed.notify_all();
+		}
+
+	private:
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::deque<std::string> chunks;
+		bool closed = false;
+		bool aborted = false;
+	};
+
+	// Collects the serialized output into chunks and queues every full chunk
+	class ChunkBuffer :public std::streambuf
+	{
+	public:
+		ChunkBuffer(ChunkQueue& queue)
+			:queue(queue), buffer(chunkSize)
+		{
+			setp(buffer.data(), buffer.data() + buffer.size());
+		}
+
+		// Queues the last partial chunk
+		void finish()
+		{
+			queueChunk();
+		}
+
+	protected:
+		int_type overflow(int_type c) override
+		{
+			queueChunk();
+			if (!traits_type::eq_int_type(c, traits_type::eof())) {
+				*pptr() = traits_type::to_char_type(c);
+				pbump(1);
+			}
+			return traits_type::not_eof(c);
+		}
+
+	private:
+		void queueChunk()
+		{
+			if (pptr() != pbase())
+				queue.push(std::string(pbase(), pptr()));
+			setp(buffer.data(), buffer.data() + buffer.size());
+		}
+
+		ChunkQueue& queue;
+		std::vector<char> buffer;
+	};
+}
+
+std::unique_ptr<Compressor> createCompressor(const std::string& method, int level)
+{
+	(void)level;	//unused if neither library is compiled in
+	if (method == "gzip") {
+#ifdef HAVE_ZLIB
+		if (level < 0 || level > 9)
+			throw std::runtime_error("gzip compression levels are 1 to 9");
+		return std::make_unique<GzipCompressor>(level);
+#else
+		throw std::runtime_error("gzip compression is not available in this build, see Compression in README.md");
+#endif
+	}
+	if (method == "zstd") {
+#ifdef HAVE_ZSTD
+		if (level < 0 || level > ZSTD_maxCLevel())
+			throw std::runtime_error("zstd compression levels are 1 to " + std::to_string(ZSTD_maxCLevel()));
+		return std::make_unique<ZstdCompressor>(level);
+#else
+		throw std::runtime_error("zstd compression is not available in this build, see Compression in README.md");
+#endif
+	}
+	throw std::runtime_error("Unknown compression method " + method);
+}
+
+// Runs tasks on threads that live as long as the sink, so outputs do not start threads of their own
+class CompressingSink::Pool
+{
+public:
+	explicit Pool(unsigned threadCount)
+	{
+		for (unsigned i = 0; i < threadCount; ++i) {
+			threads.emplace_back([this]() {
+				Trace::setThreadName("compress");
+				std::function<void()> task;
+				while (pop(task)) {
+					task();
+				}
+			});
+		}
+	}
+	~Pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ mutex };
+			stopping = true;
+		}
+		changed.notify_all();
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+	}
+
+	// The future rethrows the exception of the task
+	std::future<void> submit(std::function<void()> task)
+	{
+		auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+		std::future<void> result = packaged->get_future();
+		{
+			std::lock_guard<std::mutex> lock{ mutex };
+			tasks.push_back([packaged]() { (*packaged)(); });
+		}
+		changed.notify_one();
+		return result;
+	}
+
+private:
+	// Returns false once the pool is stopped and no task is left
+	bool pop(std::function<void()>& task)
+	{
+		std::unique_lock<std::mutex> lock{ mutex };
+		changed.wait(lock, [this]() { return !tasks.empty() || stopping; });
+		if (tasks.empty())
+			return false;
+		task = std::move(tasks.front());
+		tasks.pop_front();
+		return true;
+	}
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<std::function<void()>> tasks;
+	bool stopping = false;
+};
+
+CompressingSink::CompressingSink(OutputSink& sink, const std::string& method, int level)
+	:sink(sink), method(method), level(level)
+{
+	//Fails early if the method or level is not supported
+	extension = createCompressor(method, level)->extension();
+	pool = std::make_unique<Pool>(parallelThreads());
+}
+
+CompressingSink::~CompressingSink() = default;
+
+void CompressingSink::write(const std::string& name, const std::function<void(std::ostream&)>& writer)
+{
+	sink.write(name + extension, [&](std::ostream& output) {
+		std::unique_ptr<Compressor> compressor = createCompressor(method, level);
+		ChunkQueue queue;
+		std::future<void> compressing = pool->submit([&]() {
+			Trace::Span span{ "compress", &name };
+			try {
+				std::string chunk;
+				std::string compressed;
+				while (queue.pop(chunk)) {
+					compressor->compress(chunk.data(), chunk.size(), false, compressed);
+					output.write(compressed.data(), compressed.size());
+					compressed.clear();
+				}
+				compressor->compress(nullptr, 0, true, compressed);
+				output.write(compressed.data(), compressed.size());
+				if (!output.good())
+					throw ConversionError("Can not write " + name + extension);
+			}
+			catch (...) {
+				queue.abort();
+				throw;
+			}
+		});
+
+		std::exception_ptr writeError;
+		try {
+			ChunkBuffer buffer{ queue };
+			std::ostream stream{ &buffer };
+			writer(stream);
+			buffer.finish();
+		}
+		catch (...) {
+			writeError = std::current_exception();
+		}
+		queue.close();
+		//The task uses the locals of this function until it ends
+		compressing.wait();
+		if (writeError)
+			std::rethrow_exception(writeError);
+		compressing.get();
+	});
+}
+
+void CompressingSink::writeAll(const std::vector<const OutputFile*>& files)
+{
+	std::vector<OutputFile> compressed(files.size());
+	std::vector<std::future<void>> compressing;
+	for (size_t i = 0; i < files.size(); ++i) {
+		compressing.push_back(pool->submit([this, &files, &compressed, i]() {
+			Trace::Span span{ "compress", &files[i]->name };
+			std::unique_ptr<Compressor> compressor = createCompressor(method, level);
+			const std::string& data = files[i]->data;
+			compressed[i].name = files[i]->name + extension;
+			for (size_t offset = 0; offset < data.size(); offset += chunkSize) {
+				compressor->compress(data.data() + offset, std::min(chunkSize, data.size() - offset), false, compressed[i].data);
+			}
+			compressor->compress(nullptr, 0, true, compressed[i].data);
+		}));
+	}
+	for (std::future<void>& task : compressing) {
+		task.wait();
+	}
+	for (std::future<void>& task : compressing) {
+		task.get();
+	}
+
+	std::vector<const OutputFile*> pointers;
+	for (const OutputFile& file : compressed) {
+		pointers.push_back(&file);
+	}
+	sink.writeAll(pointers);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <memory>
+#include "OutputSink.h"
+
+// Incremental encoder of one compressed stream
+class Compressor
+{
+public:
+	virtual ~Compressor() = default;
+
+	// Appends the compressed form of data to output, finish ends the stream
+	virtual void compress(const char* data, size_t size, bool finish, std::string& output) = 0;
+	// Appended to the names of the compressed outputs
+	virtual const char* extension() const = 0;
+};
+
+// method is gzip (needs HAVE_ZLIB) or zstd (needs HAVE_ZSTD), level 0 selects the default level of the method.
+// Throws if the method was not compiled in or level is out of range
+std::unique_ptr<Compressor> createCompressor(const std::string& method, int level);
+
+// Compresses every output before it is handed to sink and appends .gz or .zst to its name.
+// The sink owns one compression thread per hardware thread for its whole lifetime. Outputs written with write are
+// serialized on the calling thread and compressed chunk by chunk on one of them, outputs that are already in memory
+// are compressed in parallel on all of them and passed to sink as one batch
+class CompressingSink :public OutputSink
+{
+public:
+	CompressingSink(OutputSink& sink, const std::string& method, int level);
+	~CompressingSink();
+
+	void write(const std::string& name, const std::function<void(std::ostream&)>& writer) override;
+	void writeAll(const std::vector<const OutputFile*>& files) override;
+	// Appended to the output names, .gz or .zst
+	const std::string& getExtension() const { return extension; }
+
+private:
+	class Pool;
+
+	OutputSink& sink;
+	std::string method;
+	int level;
+	std::string extension;
+	std::unique_ptr<Pool> pool;
+};
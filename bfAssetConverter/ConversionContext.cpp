@@ -0,0 +1,95 @@
+#include "ConversionContext.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+	//rapidxml frees all dynamic pool blocks when a document is cleared. They are parked in a cache of the
+	//calling thread instead and handed to the next document, so steady state conversions do not touch the heap
+	class BlockCache
+	{
+	public:
+		~BlockCache()
+		{
+			for (char* block : blocks) {
+				std::free(block);
+			}
+		}
+
+		void* allocate(size_t size)
+		{
+			//Best fit, a few large blocks for long number lists and many default sized ones are typical
+			size_t best = blocks.size();
+			for (size_t i = 0; i < blocks.size(); ++i) {
+				size_t blockSize = sizeOf(blocks[i]);
+				if (blockSize >= size && (best == blocks.size() || blockSize < sizeOf(blocks[best])))
+					best = i;
+			}
+			if (best != blocks.size()) {
+				char* block = blocks[best];
+				blocks[best] = blocks.back();
+				blocks.pop_back();
+				cachedBytes -= sizeOf(block);
+				return block + headerSize;
+			}
+
+			char* block = static_cast<char*>(std::malloc(size + headerSize));
+			if (!block)
+				throw std::bad_alloc();
+			*reinterpret_cast<size_t*>(block) = size;
+			return block + headerSize;
+		}
+
+		void release(void* memory)
+		{
+			char* block = static_cast<char*>(memory) - headerSize;
+			if (cachedBytes + sizeOf(block) > maxCachedBytes) {
+				std::free(block);
+				return;
+			}
+			cachedBytes += sizeOf(block);
+			blocks.push_back(block);
+		}
+
+	private:
+		//The header keeps the block size and the alignment malloc guarantees
+		static constexpr size_t headerSize = 16;
+		static constexpr size_t maxCachedBytes = 32 * 1024 * 1024;
+
+		static size_t sizeOf(const char* block) { return *reinterpret_cast<const size_t*>(block); }
+
+		std::vector<char*> blocks;
+		size_t cachedBytes = 0;
+	};
+
+	thread_local BlockCache blockCache;
+
+	void* allocateBlock(size_t size)
+	{
+		return blockCache.allocate(size);
+	}
+
+	void freeBlock(void* memory)
+	{
+		blockCache.release(memory);
+	}
+}
+
+ConversionContext::ConversionContext()
+	:doc(std::make_unique<rapidxml::xml_document<>>())
+{
+	doc->set_allocator(allocateBlock, freeBlock);
+}
+
+ConversionContext::~ConversionContext() = default;
+
+rapidxml::xml_document<>& ConversionContext::newDocument()
+{
+	doc->clear();
+	return *doc;
+}
+
+std::string& ConversionContext::text()
+{
+	textBuffer.clear();
+	return textBuffer;
+}
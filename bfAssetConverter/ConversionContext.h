@@ -0,0 +1,40 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <rapidxml/rapidxml.hpp>
+
+class GeometryStore;
+
+// State of one worker that is reused for every file it converts instead of being allocated per output:
+// the COLLADA document with its memory pool, scratch text for number lists and vertex scratch arrays.
+// A context must only be used by one thread at a time
+class ConversionContext
+{
+public:
+	ConversionContext();
+	~ConversionContext();
+	ConversionContext(const ConversionContext&) = delete;
+	ConversionContext& operator=(const ConversionContext&) = delete;
+
+	// Clears the document for the next output, the memory blocks of its pool are kept for reuse
+	rapidxml::xml_document<>& newDocument();
+	rapidxml::xml_document<>& document() { return *doc; }
+	// Empty scratch string that keeps its capacity between uses
+	std::string& text();
+
+	// Vertex scratch arrays, their contents are undefined until the user clears or resizes them
+	std::vector<float> floats;
+	std::vector<size_t> indices;
+
+	// Shared by the contexts of all workers, static and bundled meshes reference their geometries in it when it is set
+	GeometryStore* geometryStore = nullptr;
+	// Store keys the file being converted referenced, once per reference, and the keys whose files it wrote.
+	// Cleared by convertFile, the caller passes them to GeometryStore::commit once the outputs are written
+	std::vector<std::string> geometryReferences;
+	std::vector<std::string> geometryFiles;
+
+private:
+	std::unique_ptr<rapidxml::xml_document<>> doc;
+	std::string textBuffer;
+};
@@ -0,0 +1,127 @@
+#include "Converter.h"
+#include <rapidxml/rapidxml_print.hpp>
+#include "SkinnedMesh.h"
+#include "BundledMesh.h"
+#include "StaticMesh.h"
+#include "CollisionMesh.h"
+
+std::string getExtension(const std::string& filename)
+{
+	size_t pos = filename.find_last_of('.');
+	if (pos == std::string::npos)
+		return "";
+	return filename.substr(pos + 1);
+}
+
+std::string defaultOutputFile(const std::string& filename)
+{
+	size_t pos = filename.find_last_of('.');
+	if (pos == std::string::npos)
+		pos = filename.length();
+	return filename.substr(0, pos);
+}
+
+std::string baseName(const std::string& filename)
+{
+	size_t pos = filename.find_last_of("/\\");
+	return defaultOutputFile(pos == std::string::npos ? filename : filename.substr(pos + 1));
+}
+
+void convertFile(std::istream& input, const std::string& output, const std::string& extension, const std::string& format, const Skeleton* skeleton,
+	const AnimationList& animations, OutputSink& sink, ConversionContext& context, bool streamMeshes)
+{
+	bool animationFormat = format.compare("poses") == 0 || format.compare("clip") == 0;
+	if ((animationFormat && extension.compare("baf") != 0) || (format.compare("vcache") == 0 && extension.compare("skinnedmesh") != 0)
+		|| (format.compare("accel") == 0 && extension.compare("collisionmesh") != 0))
+		throw Utils::ConversionError("Format " + format + " is not supported for " + extension + " files");
+	bool arrays = format.compare("npz") == 0;
+	context.geometryReferences.clear();
+	context.geometryFiles.clear();
+	//Only the COLLADA export reads one material at a time
+	bool streamBuffers = streamMeshes && format.compare("dae") == 0;
+
+	if(extension.compare("baf") == 0) {
+		if (!skeleton)
+			throw Utils::ConversionError("Animations require a skeleton file");
+		Animation anim{ input, *skeleton };
+		if (format.compare("poses") == 0) {
+			sink.write(output + ".bfpose", [&anim](std::ostream& stream) { anim.writePoseCache(stream); });
+		}
+		else if (format.compare("clip") == 0) {
+			sink.write(output + ".bfclip", [&anim](std::ostream& stream) { anim.writeClip(stream); });
+		}
+		else if (arrays) {
+			anim.writeArrays(output, sink);
+		}
+		else {
+			rapidxml::xml_document<>& doc = context.newDocument();
+			rapidxml::xml_node<>* root = Utils::createColladaFramework(doc);
+			anim.writeToCollada(context, root);
+			sink.write(output + ".dae", [&doc](std::ostream& stream) { stream << doc; });
+		}
+	}
+	else if (extension.compare("skinnedmesh") == 0) {
+		if (!skeleton)
+			throw Utils::ConversionError("Skinnedmeshes require a skeleton file");
+		SkinnedMesh mesh{ input, *skeleton };
+		if (format.compare("vcache") == 0) {
+			if (animations.empty())
+				throw Utils::ConversionError("Vertex caches require at least one animation");
+			for (const auto& animation : animations) {
+				mesh.writeVertexCaches(output, animation.first, *animation.second, sink, context);
+			}
+		}
+		else if (arrays) {
+			mesh.writeArrays(output, sink);
+		}
+		else {
+			mesh.writeFiles(output, sink, context);
+		}
+	}
+	else if (extension.compare("bundledmesh") == 0) {
+		BundledMesh mesh{ input, streamBuffers };
+		if (arrays)
+			mesh.writeArrays(output, sink);
+		else
+			mesh.writeFiles(output, sink, context);
+	}
+	else if (extension.compare("staticmesh") == 0) {
+		StaticMesh mesh{ input, streamBuffers };
+		if (arrays)
+			mesh.writeArrays(output, sink);
+		else
+			mesh.writeFiles(output, sink, context);
+	}
+	else if (extension.compare("collisionmesh") == 0) {
+		CollisionMesh mesh{ input };
+		if (format.compare("accel") == 0) {
+			sink.write(output + ".bfaccel", [&mesh](std::ostream& stream) { mesh.writeAccelerationData(stream); });
+		}
+		else if (arrays) {
+			mesh.writeArrays(output, sink);
+		}
+		else {
+			mesh.writeFiles(output, sink, context);
+		}
+	}
+	else {
+		throw Utils::ConversionError("Unsupported filetype " + extension);
+	}
+}
+
+std::vector<OutputFile> convertBuffer(ConversionContext& context, const char* data, size_t size, const std::string& output, const std::string& extension,
+	const std::string& format, const Skeleton* skeleton, const AnimationList& animations)
+{
+	Utils::MemoryBuffer buffer{ data, size };
+	std::istream input{ &buffer };
+	MemorySink sink;
+	convertFile(input, output, extension, format, skeleton, animations, sink, context);
+	return sink.takeFiles();
+}
+
+std::vector<OutputFile> convertBuffer(const char* data, size_t size, const std::string& output, const std::string& extension,
+	const std::string& format, const Skeleton* skeleton, const AnimationList& animations)
+{
+	ConversionContext context;
+	return convertBuffer(context, data, size, output, extension, format, skeleton, animations);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <istream>
+#include <memory>
+#include "OutputSink.h"
+#include "Skeleton.h"
+#include "Animation.h"
+#include "ConversionContext.h"
+
+typedef std::vector<std::pair<std::string, std::shared_ptr<const Animation>>> AnimationList;
+
+std::string getExtension(const std::string& filename);
+// Filename without extension
+std::string defaultOutputFile(const std::string& filename);
+// Filename without folder and extension
+std::string baseName(const std::string& filename);
+
+// Converts one asset of type extension (baf, skinnedmesh, ...) to format. Every output is named output + suffix and handed to sink.
+// Documents and scratch buffers are taken from context, callers that convert many files keep one context per thread.
+// With streamMeshes static and bundled meshes are read one material at a time while they are written, input must be seekable
+void convertFile(std::istream& input, const std::string& output, const std::string& extension, const std::string& format, const Skeleton* skeleton,
+	const AnimationList& animations, OutputSink& sink, ConversionContext& context, bool streamMeshes = false);
+
+// Converts an asset held in memory and returns all outputs, the file system is not touched
+std::vector<OutputFile> convertBuffer(ConversionContext& context, const char* data, size_t size, const std::string& output, const std::string& extension,
+	const std::string& format = "dae", const Skeleton* skeleton = nullptr, const AnimationList& animations = AnimationList{});
+// Same with a context of its own
+std::vector<OutputFile> convertBuffer(const char* data, size_t size, const std::string& output, const std::string& extension,
+	const std::string& format = "dae", const Skeleton* skeleton = nullptr, const AnimationList& animations = AnimationList{});
@@ -0,0 +1,297 @@
+#include "Daemon.h"
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <list>
+#include <functional>
+#include <iterator>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+#include "Converter.h"
+
+using namespace Utils;
+
+namespace {
+	time_t modificationTime(const std::string& filename)
+	{
+		struct stat info;
+		if (stat(filename.c_str(), &info) != 0)
+			throw ConversionError("Could not open " + filename);
+		return info.st_mtime;
+	}
+
+	std::string readFile(const std::string& filename)
+	{
+		std::ifstream file{ filename, std::ifstream::in | std::ifstream::binary };
+		if (!file.good())
+			throw ConversionError("Could not open " + filename);
+		std::ostringstream data;
+		data << file.rdbuf();
+		return data.str();
+	}
+
+	std::string base64(const std::string& data)
+	{
+		const char* digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		std::string result;
+		result.reserve((data.size() + 2) / 3 * 4);
+		for (size_t i = 0; i < data.size(); i += 3) {
+			uint32_t block = uint32_t(uint8_t(data[i])) << 16;
+			if (i + 1 < data.size())
+				block |= uint32_t(uint8_t(data[i + 1])) << 8;
+			if (i + 2 < data.size())
+				block |= uint8_t(data[i + 2]);
+			result.push_back(digits[(block >> 18) & 63]);
+			result.push_back(digits[(block >> 12) & 63]);
+			result.push_back(i + 1 < data.size() ? digits[(block >> 6) & 63] : '=');
+			result.push_back(i + 2 < data.size() ? digits[block & 63] : '=');
+		}
+		return result;
+	}
+
+	// Objects loaded from a file, reloaded when the modification time of the file changes.
+	// The least recently used entries are dropped while the sizes of all entries exceed budget
+	template<typename T> class FileCache {
+	public:
+		FileCache(size_t budget = SIZE_MAX, std::function<size_t(const T&)> sizeOf = [](const T&) { return size_t(0); })
+			:budget(budget), sizeOf(sizeOf) {}
+
+		std::shared_ptr<const T> get(const std::string& key, time_t mtime, const std::function<std::shared_ptr<const T>()>& load)
+		{
+			auto it = entries.find(key);
+			if (it != entries.end() && it->second.mtime == mtime) {
+				order.splice(order.end(), order, it->second.position);
+				return it->second.value;
+			}
+			std::shared_ptr<const T> value = load();
+			erase(key);
+			size_t size = sizeOf(*value);
+			order.push_back(key);
+			entries[key] = Entry{ mtime, value, size, std::prev(order.end()) };
+			totalSize += size;
+			while (totalSize > budget && !order.empty()) {
+				erase(order.front());
+			}
+			return value;
+		}
+
+		// Drops all entries whose key starts with prefix
+		void erasePrefix(const std::string& prefix)
+		{
+			auto it = entries.lower_bound(prefix);
+			while (it != entries.end() && it->first.compare(0, prefix.size(), prefix) == 0) {
+				totalSize -= it->second.size;
+				order.erase(it->second.position);
+				it = entries.erase(it);
+			}
+		}
+
+	private:
+		struct Entry {
+			time_t mtime;
+			std::shared_ptr<const T> value;
+			size_t size;
+			std::list<std::string>::iterator position;
+		};
+
+		void erase(const std::string& key)
+		{
+			auto it = entries.find(key);
+			if (it == entries.end())
+				return;
+			totalSize -= it->second.size;
+			order.erase(it->second.position);
+			entries.erase(it);
+		}
+
+		size_t budget;
+		std::function<size_t(const T&)> sizeOf;
+		std::map<std::string, Entry> entries;
+		std::list<std::string> order;		//least recently used first
+		size_t totalSize = 0;
+	};
+
+	// An animation refers to its skeleton, so a cached animation keeps the skeleton alive after the skeleton file is reloaded
+	struct SkeletonAnimation {
+		SkeletonAnimation(std::shared_ptr<const Skeleton> skeletonPtr, std::istream& stream)
+			:skeleton(std::move(skeletonPtr)), animation(stream, *skeleton) {}
+
+		std::shared_ptr<const Skeleton> skeleton;
+		Animation animation;
+	};
+
+	class Daemon {
+	public:
+		Daemon(size_t cacheBudget)
+			:animations(cacheBudget / 4, [](const Animation& animation) { return animation.memoryUsage(); }), results(cacheBudget, outputsSize) {}
+
+		void runJob(const rapidjson::Value& job, rapidjson::Writer<rapidjson::StringBuffer>& writer);
+
+	private:
+		std::string getString(const rapidjson::Value& job, const char* name, const std::string& defaultValue) const;
+		std::shared_ptr<const std::vector<OutputFile>> convert(const rapidjson::Value& job, const std::string& inputName, const std::string& outputName,
+			const std::string& format);
+		static size_t outputsSize(const std::vector<OutputFile>& files);
+
+		FileCache<Skeleton> skeletons;
+		FileCache<Animation> animations;
+		FileCache<std::vector<OutputFile>> results;	//by the input and everything else the conversion depends on
+		ConversionContext context;
+	};
+
+	void Daemon::runJob(const rapidjson::Value& job, rapidjson::Writer<rapidjson::StringBuffer>& writer)
+	{
+		if (!job.IsObject() || !job.HasMember("input") || !job["input"].IsString())
+			throw ConversionError("Job requires an input");
+		std::string inputName = job["input"].GetString();
+		std::string outputName = getString(job, "output", defaultOutputFile(inputName));
+		std::string format = getString(job, "format", "dae");
+		std::string returnType = getString(job, "return", "paths");
+		if (returnType != "paths" && returnType != "bytes")
+			throw ConversionError("Unknown return type " + returnType);
+
+		std::shared_ptr<const std::vector<OutputFile>> files = convert(job, inputName, outputName, format);
+
+		writer.Key("outputs");
+		writer.StartArray();
+		for (const OutputFile& file : *files) {
+			if (returnType == "paths") {
+				std::ofstream output{ file.name, std::ofstream::out | std::ofstream::binary };
+				if (!output.good())
+					throw ConversionError("Can not write to output file " + file.name);
+				output.write(file.data.data(), file.data.size());
+			}
+
+			writer.StartObject();
+			writer.Key("name");
+			writer.String(file.name.c_str(), static_cast<rapidjson::SizeType>(file.name.size()));
+			if (returnType == "bytes") {
+				std::string data = base64(file.data);
+				writer.Key("data");
+				writer.String(data.c_str(), static_cast<rapidjson::SizeType>(data.size()));
+			}
+			writer.EndObject();
+		}
+		writer.EndArray();
+	}
+
+	std::string Daemon::getString(const rapidjson::Value& job, const char* name, const std::string& defaultValue) const
+	{
+		if (!job.HasMember(name))
+			return defaultValue;
+		if (!job[name].IsString())
+			throw ConversionError(std::string(name) + " must be a string");
+		return job[name].GetString();
+	}
+
+	std::shared_ptr<const std::vector<OutputFile>> Daemon::convert(const rapidjson::Value& job, const std::string& inputName, const std::string& outputName,
+		const std::string& format)
+	{
+		//The key holds everything the result depends on, the input file is checked through its modification time
+		std::string key = inputName + '|' + outputName + '|' + format;
+		std::shared_ptr<const Skeleton> skeleton;
+		std::string skeletonKey;
+		if (job.HasMember("skeleton")) {
+			std::string skeletonName = getString(job, "skeleton", "");
+			time_t skeletonTime = modificationTime(skeletonName);
+			skeleton = skeletons.get(skeletonName, skeletonTime, [this, &skeletonName]() {
+				//Animations of the previous version of the skeleton are not used anymore
+				animations.erasePrefix(skeletonName + '@');
+				std::ifstream file{ skeletonName, std::ifstream::in | std::ifstream::binary };
+				if (!file.good())
+					throw ConversionError("Could not open skeleton file " + skeletonName);
+				return std::make_shared<const Skeleton>(file);
+			});
+			skeletonKey = skeletonName + '@' + std::to_string(skeletonTime);
+			key += '|' + skeletonKey;
+		}
+
+		AnimationList animationList;
+		if (job.HasMember("animations")) {
+			const rapidjson::Value& names = job["animations"];
+			if (!names.IsArray())
+				throw ConversionError("animations must be an array");
+			if (!skeleton)
+				throw ConversionError("Animations require a skeleton file");
+			for (rapidjson::SizeType i = 0; i < names.Size(); ++i) {
+				if (!names[i].IsString())
+					throw ConversionError("animations must be an array of strings");
+				std::string animationName = names[i].GetString();
+				time_t animationTime = modificationTime(animationName);
+				std::shared_ptr<const Animation> animation = animations.get(skeletonKey + '|' + animationName, animationTime, [&]() {
+					std::ifstream file{ animationName, std::ifstream::in | std::ifstream::binary };
+					if (!file.good())
+						throw ConversionError("Could not open animation file " + animationName);
+					auto loaded = std::make_shared<const SkeletonAnimation>(skeleton, file);
+					return std::shared_ptr<const Animation>(loaded, &loaded->animation);
+				});
+				animationList.emplace_back(baseName(animationName), animation);
+				key += '|' + animationName + '@' + std::to_string(animationTime);
+			}
+		}
+
+		return results.get(key, modificationTime(inputName), [&]() {
+			std::string data = readFile(inputName);
+			return std::make_shared<const std::vector<OutputFile>>(
+				convertBuffer(context, data.data(), data.size(), outputName, getExtension(inputName), format, skeleton.get(), animationList));
+		});
+	}
+
+	size_t Daemon::outputsSize(const std::vector<OutputFile>& files)
+	{
+		size_t size = 0;
+		for (const OutputFile& file : files) {
+			size += file.name.size() + file.data.size();
+		}
+		return size;
+	}
+}
+
+void runDaemon(std::istream& input, std::ostream& output, size_t cacheBudget)
+{
+	Daemon daemon{ cacheBudget };
+	std::string line;
+	while (std::getline(input, line)) {
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		rapidjson::Document job;
+		job.Parse(line.c_str());
+
+		rapidjson::StringBuffer buffer;
+		rapidjson::Writer<rapidjson::StringBuffer> writer{ buffer };
+		auto startAnswer = [&]() {
+			writer.StartObject();
+			writer.Key("id");
+			if (!job.HasParseError() && job.IsObject() && job.HasMember("id"))
+				job["id"].Accept(writer);
+			else
+				writer.Null();
+		};
+		startAnswer();
+
+		try {
+			if (job.HasParseError())
+				throw ConversionError("Invalid JSON");
+			daemon.runJob(job, writer);
+			writer.Key("status");
+			writer.String("ok");
+		}
+		catch (std::exception& e) {
+			//Start over so a partially written answer is dropped
+			buffer.Clear();
+			writer.Reset(buffer);
+			startAnswer();
+			writer.Key("status");
+			writer.String("error");
+			writer.Key("message");
+			writer.String(e.what());
+		}
+		writer.EndObject();
+		output << buffer.GetString() << std::endl;
+	}
+}
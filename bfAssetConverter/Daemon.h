@@ -0,0 +1,11 @@
+#pragma once
+#include <istream>
+#include <ostream>
+
+// Serves conversion jobs until input ends. Every line of input is one job, every job is answered with one line of output.
+// Job:		{"id": any, "input": "file", "output": "base", "format": "dae", "skeleton": "file.ske", "animations": ["file.baf"], "return": "paths"}
+//			only input is required, return is either paths (outputs are written to disk) or bytes (base64 encoded in the answer)
+// Answer:	{"id": any, "status": "ok", "outputs": [{"name": "file", "data": "base64"}]} or {"id": any, "status": "error", "message": "text"}
+// Skeletons, animations and conversion results stay cached as long as their files are not modified. Results are limited to
+// cacheBudget bytes and animations to a quarter of it, the least recently used ones are dropped first
+void runDaemon(std::istream& input, std::ostream& output, size_t cacheBudget);
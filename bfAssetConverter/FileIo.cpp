@@ -0,0 +1,319 @@
+#include "FileIo.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "OutputSink.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <chrono>
+#endif
+#endif
+
+std::vector<ReadResult> BlockingFileIo::readFiles(const std::vector<std::string>& filenames)
+{
+	std::vector<ReadResult> results(filenames.size());
+	for (size_t i = 0; i < filenames.size(); ++i) {
+		std::ifstream file{ filenames[i], std::ifstream::in | std::ifstream::binary };
+		if (!file.good()) {
+			results[i].error = "Could not open input";
+			continue;
+		}
+		std::ostringstream data;
+		data << file.rdbuf();
+		results[i].data = data.str();
+	}
+	return results;
+}
+
+std::vector<std::string> BlockingFileIo::writeFiles(const std::vector<const OutputFile*>& files)
+{
+	std::vector<std::string> errors(files.size());
+	for (size_t i = 0; i < files.size(); ++i) {
+		std::ofstream output{ files[i]->name, std::ofstream::out | std::ofstream::binary };
+		output.write(files[i]->data.data(), files[i]->data.size());
+		if (!output.good())
+			errors[i] = "Can not write to output file " + files[i]->name;
+	}
+	return errors;
+}
+
+#ifdef HAVE_IO_URING
+namespace {
+	// Raw io_uring without liburing. Every batch is submitted with one system call and waited for as a whole
+	class UringFileIo :public FileIo
+	{
+	public:
+		UringFileIo();
+		~UringFileIo();
+
+		bool isValid() const { return ringFd >= 0; }
+
+		std::vector<ReadResult> readFiles(const std::vector<std::string>& filenames) override;
+		std::vector<std::string> writeFiles(const std::vector<const OutputFile*>& files) override;
+
+	private:
+		struct Request {
+			int fd;
+			iovec buffer;
+			bool write;
+			int32_t result;	//res of the completion, bytes or -errno
+			size_t done;	//bytes transferred, a file can be larger than result can hold
+			bool completed;
+		};
+
+		void run(std::vector<Request>& requests);
+		unsigned reapCompletions(std::vector<Request>& requests);
+		void abandonBatch(std::vector<Request>& requests, size_t first, unsigned submitted, unsigned completed);
+		bool finishShortTransfer(Request& request) const;
+
+		std::mutex mutex;
+		bool broken = false;	//after a failed io_uring_enter, every request takes the fallback
+		int ringFd = -1;
+		unsigned entries = 0;
+		void* sqRing = MAP_FAILED;
+		size_t sqRingSize = 0;
+		void* cqRing = MAP_FAILED;
+		size_t cqRingSize = 0;
+		io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+		size_t sqesSize = 0;
+		std::atomic<unsigned>* sqHead = nullptr;
+		std::atomic<unsigned>* sqTail = nullptr;
+		unsigned sqMask = 0;
+		unsigned* sqArray = nullptr;
+		std::atomic<unsigned>* cqHead = nullptr;
+		std::atomic<unsigned>* cqTail = nullptr;
+		unsigned cqMask = 0;
+		io_uring_cqe* cqes = nullptr;
+	};
+
+	UringFileIo::UringFileIo()
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		ringFd = static_cast<int>(syscall(__NR_io_uring_setup, 64, &params));
+		if (ringFd < 0)
+			return;
+
+		entries = params.sq_entries;
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMap)
+			sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+		cqRing = singleMap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+		if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+			close(ringFd);
+			ringFd = -1;
+			return;
+		}
+
+		char* sq = static_cast<char*>(sqRing);
+		sqHead = reinterpret_cast<std::atomic<unsigned>*>(sq + params.sq_off.head);
+		sqTail = reinterpret_cast<std::atomic<unsigned>*>(sq + params.sq_off.tail);
+		sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		char* cq = static_cast<char*>(cqRing);
+		cqHead = reinterpret_cast<std::atomic<unsigned>*>(cq + params.cq_off.head);
+		cqTail = reinterpret_cast<std::atomic<unsigned>*>(cq + params.cq_off.tail);
+		cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+	}
+
+	UringFileIo::~UringFileIo()
+	{
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqesSize);
+		if (cqRing != MAP_FAILED && cqRing != sqRing)
+			munmap(cqRing, cqRingSize);
+		if (sqRing != MAP_FAILED)
+			munmap(sqRing, sqRingSize);
+		if (ringFd >= 0)
+			close(ringFd);
+	}
+
+	void UringFileIo::run(std::vector<Request>& requests)
+	{
+		std::lock_guard<std::mutex> lock{ mutex };
+		for (size_t first = 0; first < requests.size(); first += entries) {
+			if (broken) {
+				for (size_t i = first; i < requests.size(); ++i) {
+					requests[i].result = -EIO;
+				}
+				return;
+			}
+			unsigned count = static_cast<unsigned>(std::min<size_t>(entries, requests.size() - first));
+			unsigned tail = sqTail->load(std::memory_order_relaxed);
+			for (unsigned i = 0; i < count; ++i) {
+				Request& request = requests[first + i];
+				unsigned index = (tail + i) & sqMask;
+				io_uring_sqe& sqe = sqes[index];
+				memset(&sqe, 0, sizeof(sqe));
+				sqe.opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+				sqe.fd = request.fd;
+				sqe.addr = reinterpret_cast<uint64_t>(&request.buffer);
+				sqe.len = 1;
+				sqe.off = 0;
+				sqe.user_data = first + i;
+				sqArray[index] = index;
+			}
+			sqTail->store(tail + count, std::memory_order_release);
+
+			unsigned completed = 0;
+			unsigned submitted = 0;
+			while (completed < count) {
+				int result = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, count - submitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+				if (result < 0) {
+					int error = errno;
+					if (error == EINTR || error == EAGAIN || error == EBUSY) {
+						//Temporary, EBUSY asks to reap completions before submitting more
+						completed += reapCompletions(requests);
+						if (error != EINTR)
+							std::this_thread::yield();
+						continue;
+					}
+					abandonBatch(requests, first, submitted, completed);
+					return;
+				}
+				submitted += result;
+				completed += reapCompletions(requests);
+			}
+		}
+	}
+
+	unsigned UringFileIo::reapCompletions(std::vector<Request>& requests)
+	{
+		unsigned count = 0;
+		unsigned head = cqHead->load(std::memory_order_relaxed);
+		unsigned cqTailValue = cqTail->load(std::memory_order_acquire);
+		for (; head != cqTailValue; ++head) {
+			const io_uring_cqe& cqe = cqes[head & cqMask];
+			Request& request = requests[cqe.user_data];
+			request.result = cqe.res;
+			request.done = cqe.res > 0 ? size_t(cqe.res) : 0;
+			request.completed = true;
+			++count;
+		}
+		cqHead->store(head, std::memory_order_release);
+		return count;
+	}
+
+	// The ring failed. The kernel may still use the buffers of submitted requests, so they are waited for before the caller
+	// gets them back. Entries that were not submitted are taken back from the ring and every request without a completion fails
+	void UringFileIo::abandonBatch(std::vector<Request>& requests, size_t first, unsigned submitted, unsigned completed)
+	{
+		broken = true;
+		sqTail->store(sqHead->load(std::memory_order_acquire), std::memory_order_release);
+		completed += reapCompletions(requests);
+		while (completed < submitted) {
+			if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			completed += reapCompletions(requests);
+		}
+		for (size_t i = first; i < requests.size(); ++i) {
+			if (!requests[i].completed)
+				requests[i].result = -EIO;
+		}
+	}
+
+	// Completes a request that was cut short or refused by the ring with plain system calls, returns false if that fails too
+	bool UringFileIo::finishShortTransfer(Request& request) const
+	{
+		char* data = static_cast<char*>(request.buffer.iov_base);
+		while (request.done < request.buffer.iov_len) {
+			ssize_t result = request.write ? pwrite(request.fd, data + request.done, request.buffer.iov_len - request.done, off_t(request.done))
+				: pread(request.fd, data + request.done, request.buffer.iov_len - request.done, off_t(request.done));
+			if (result <= 0)
+				return false;
+			request.done += size_t(result);
+		}
+		return true;
+	}
+
+	std::vector<ReadResult> UringFileIo::readFiles(const std::vector<std::string>& filenames)
+	{
+		std::vector<ReadResult> results(filenames.size());
+		std::vector<Request> requests;
+		std::vector<size_t> owners;
+		for (size_t i = 0; i < filenames.size(); ++i) {
+			int fd = open(filenames[i].c_str(), O_RDONLY | O_CLOEXEC);
+			struct stat info;
+			if (fd < 0 || fstat(fd, &info) != 0) {
+				if (fd >= 0)
+					close(fd);
+				results[i].error = "Could not open input";
+				continue;
+			}
+			results[i].data.resize(info.st_size);
+			requests.push_back(Request{ fd, { &results[i].data[0], results[i].data.size() }, false, 0, 0, false });
+			owners.push_back(i);
+		}
+
+		run(requests);
+		for (size_t i = 0; i < requests.size(); ++i) {
+			if (!finishShortTransfer(requests[i])) {
+				results[owners[i]].data.clear();
+				results[owners[i]].error = "Could not read input";
+			}
+			close(requests[i].fd);
+		}
+		return results;
+	}
+
+	std::vector<std::string> UringFileIo::writeFiles(const std::vector<const OutputFile*>& files)
+	{
+		std::vector<std::string> errors(files.size());
+		std::vector<Request> requests;
+		std::vector<size_t> owners;
+		for (size_t i = 0; i < files.size(); ++i) {
+			int fd = open(files[i]->name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (fd < 0) {
+				errors[i] = "Can not write to output file " + files[i]->name;
+				continue;
+			}
+			requests.push_back(Request{ fd, { const_cast<char*>(files[i]->data.data()), files[i]->data.size() }, true, 0, 0, false });
+			owners.push_back(i);
+		}
+
+		run(requests);
+		for (size_t i = 0; i < requests.size(); ++i) {
+			bool written = finishShortTransfer(requests[i]);
+			if (close(requests[i].fd) != 0 || !written)
+				errors[owners[i]] = "Can not write to output file " + files[owners[i]]->name;
+		}
+		return errors;
+	}
+}
+#endif
+
+std::unique_ptr<FileIo> createFileIo(const std::string& backend)
+{
+	if (backend == "uring") {
+#ifdef HAVE_IO_URING
+		auto uring = std::make_unique<UringFileIo>();
+		if (uring->isValid())
+			return uring;
+		std::cerr << "io_uring is not available, using blocking I/O" << std::endl;
+#else
+		std::cerr << "io_uring is only supported on Linux, using blocking I/O" << std::endl;
+#endif
+	}
+	return std::make_unique<BlockingFileIo>();
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+
+struct OutputFile;
+
+struct ReadResult {
+	std::string data;
+	std::string error;	//empty on success
+};
+
+// Reads and writes whole files in batches
+class FileIo
+{
+public:
+	virtual ~FileIo() = default;
+
+	virtual std::vector<ReadResult> readFiles(const std::vector<std::string>& filenames) = 0;
+	// Returns one error message per file, empty on success
+	virtual std::vector<std::string> writeFiles(const std::vector<const OutputFile*>& files) = 0;
+};
+
+// One file after another with std::ifstream and std::ofstream
+class BlockingFileIo :public FileIo
+{
+public:
+	std::vector<ReadResult> readFiles(const std::vector<std::string>& filenames) override;
+	std::vector<std::string> writeFiles(const std::vector<const OutputFile*>& files) override;
+};
+
+// backend is blocking or uring. io_uring is only available on Linux, otherwise or if the kernel refuses it the blocking backend is returned
+std::unique_ptr<FileIo> createFileIo(const std::string& backend);
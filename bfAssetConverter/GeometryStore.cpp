@@ -0,0 +1,143 @@
+#include "GeometryStore.h"
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+	// 64 bit FNV-1a, the key also holds the vertex and index counts so a collision needs equally sized geometries
+	uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i) {
+			hash ^= bytes[i];
+			hash *= 0x100000001B3ull;
+		}
+		return hash;
+	}
+
+	std::vector<std::string> splitPath(const std::string& path)
+	{
+		std::vector<std::string> parts;
+		size_t start = 0;
+		while (start <= path.size()) {
+			size_t end = path.find_first_of("/\\", start);
+			if (end == std::string::npos)
+				end = path.size();
+			std::string part = path.substr(start, end - start);
+			if (!part.empty() && part != ".")
+				parts.push_back(part);
+			start = end + 1;
+		}
+		return parts;
+	}
+
+	bool isAbsolute(const std::string& path)
+	{
+		return (!path.empty() && (path[0] == '/' || path[0] == '\\')) || path.find(':') != std::string::npos;
+	}
+
+	std::string megabytes(size_t bytes)
+	{
+		char text[32];
+		snprintf(text, sizeof(text), "%.1f MB", bytes / (1024.0 * 1024.0));
+		return text;
+	}
+}
+
+GeometryStore::GeometryStore(const std::string& folder, const std::string& fileSuffix)
+	:folder(folder), fileSuffix(fileSuffix)
+{
+	while (!this->folder.empty() && (this->folder.back() == '/' || this->folder.back() == '\\')) {
+		this->folder.pop_back();
+	}
+}
+
+std::string GeometryStore::add(const VertexLayout& layout, const float* vertices, size_t vertexCount, const uint16_t* indices, size_t indexCount,
+	bool& write)
+{
+	size_t vertexBytes = vertexCount * layout.stride * sizeof(float);
+	size_t indexBytes = indexCount * sizeof(uint16_t);
+	uint64_t hash = 0xCBF29CE484222325ull;
+	hash = hashBytes(hash, &layout, sizeof(layout));
+	hash = hashBytes(hash, vertices, vertexBytes);
+	hash = hashBytes(hash, indices, indexBytes);
+	char key[64];
+	snprintf(key, sizeof(key), "geom_%016llx_%zu_%zu", static_cast<unsigned long long>(hash), vertexCount, indexCount);
+
+	std::lock_guard<std::mutex> lock{ mutex };
+	auto inserted = entries.emplace(key, Entry{ 0, vertexBytes + indexBytes, false });
+	write = !inserted.first->second.stored;
+	return key;
+}
+
+void GeometryStore::commit(const std::vector<std::string>& references, const std::vector<std::string>& written)
+{
+	std::lock_guard<std::mutex> lock{ mutex };
+	for (const std::string& key : written) {
+		entries.at(key).stored = true;
+	}
+	for (const std::string& key : references) {
+		Entry& entry = entries.at(key);
+		++entry.references;
+		++this->references;
+		referencedBytes += entry.bytes;
+	}
+}
+
+bool GeometryStore::isStored(const std::string& key) const
+{
+	std::lock_guard<std::mutex> lock{ mutex };
+	auto it = entries.find(key);
+	return it != entries.end() && it->second.stored;
+}
+
+std::string GeometryStore::fileName(const std::string& key) const
+{
+	return (folder.empty() ? "" : folder + "/") + key + ".dae";
+}
+
+std::string GeometryStore::url(const std::string& outputName, const std::string& key) const
+{
+	std::string target = fileName(key) + fileSuffix;
+	std::string fragment = "#" + key + "-mesh";
+	if (isAbsolute(target)) {
+		std::replace(target.begin(), target.end(), '\\', '/');
+		return "file://" + std::string(target[0] == '/' ? "" : "/") + target + fragment;
+	}
+
+	//Both paths are relative to the working directory, the common folders are skipped
+	std::vector<std::string> from = splitPath(outputName);
+	from.pop_back();
+	std::vector<std::string> to = splitPath(target);
+	size_t common = 0;
+	while (common < from.size() && common + 1 < to.size() && from[common] == to[common]) {
+		++common;
+	}
+	std::string url;
+	for (size_t i = common; i < from.size(); ++i) {
+		url += "../";
+	}
+	for (size_t i = common; i < to.size(); ++i) {
+		url += to[i] + (i + 1 < to.size() ? "/" : "");
+	}
+	return url + fragment;
+}
+
+void GeometryStore::writeReport(std::ostream& log) const
+{
+	std::lock_guard<std::mutex> lock{ mutex };
+	//Geometries of files that failed are not counted
+	size_t storedCount = 0;
+	size_t storedBytes = 0;
+	for (const auto& entry : entries) {
+		if (entry.second.stored) {
+			++storedCount;
+			storedBytes += entry.second.bytes;
+		}
+	}
+	double ratio = storedCount == 0 ? 1.0 : double(references) / storedCount;
+	char ratioText[32];
+	snprintf(ratioText, sizeof(ratioText), "%.2f", ratio);
+	log << "Geometry store: " << references << " geometries, " << storedCount << " unique (dedup ratio " << ratioText << "), "
+		<< megabytes(referencedBytes) << " of vertex and index data stored as " << megabytes(storedBytes) << std::endl;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <ostream>
+#include <cstdint>
+#include "VertexLayout.h"
+
+// Content addressed store of material geometries shared by all converted files. Every geometry is named after the hash
+// of its vertex layout, vertices and indices and written once as <folder>/<hash>.dae, the converted files reference it
+// instead of containing it. Can be used from several threads at once.
+// A geometry only counts as stored once the outputs of a file that wrote it were committed, until then every file that
+// references it writes it too. Files that fail are never committed, so no output points at a geometry that was not written
+class GeometryStore
+{
+public:
+	// fileSuffix is appended to the output names by the sink, e.g. .gz when the outputs are compressed
+	explicit GeometryStore(const std::string& folder, const std::string& fileSuffix = "");
+
+	// Returns the key of the geometry with this content. write is set while the geometry is not stored,
+	// the caller then has to write fileName(key) with its outputs
+	std::string add(const VertexLayout& layout, const float* vertices, size_t vertexCount, const uint16_t* indices, size_t indexCount, bool& write);
+	// Called once all outputs of a file are written, with the keys it referenced (once per reference) and the keys it wrote
+	void commit(const std::vector<std::string>& references, const std::vector<std::string>& written);
+	bool isStored(const std::string& key) const;
+
+	// Output name of the geometry file
+	std::string fileName(const std::string& key) const;
+	// Url of the geometry in its file, relative to the folder of outputName. The file writes it with key as object name
+	std::string url(const std::string& outputName, const std::string& key) const;
+
+	// Number of references, unique geometries and their source sizes
+	void writeReport(std::ostream& log) const;
+
+private:
+	struct Entry {
+		size_t references;
+		size_t bytes;
+		bool stored;
+	};
+
+	std::string folder;
+	std::string fileSuffix;
+	mutable std::mutex mutex;
+	std::unordered_map<std::string, Entry> entries;
+	size_t references = 0;
+	size_t referencedBytes = 0;
+};
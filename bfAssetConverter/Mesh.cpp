@@ -1,7 +1,12 @@
 #include "Mesh.h"
+#include "Trace.h"
 #include <sstream>
+#include <cstring>
 #include <tuple>
+#include <iterator>
+#include <cassert>
 #include <memory>
+#include <algorithm>
 #include <fstream>
 #include <rapidxml/rapidxml_print.hpp>
 #include <iostream>
@@ -9,54 +14,90 @@
 using namespace Utils;
 using namespace rapidxml;
 
-Mesh::Mesh(std::istream& stream)
+Mesh::Mesh(std::istream& stream, bool streamBuffers)
 {
+	Trace::Span span{ "Mesh::Mesh" };
+	std::streamoff start = stream.tellg();
+	if (start >= 0) {
+		stream.seekg(0, std::ios::end);
+		inputEnd = stream.tellg();
+		stream.seekg(start);
+	}
 	stream.ignore(1 * 4);	//unused
 	readBinary(stream, &version);
 	stream.ignore(3 * 4);
 
 	//Geometry table
 	stream.ignore(1);
-	uint32_t geomCount;
-	readBinary(stream, &geomCount);
+	uint32_t geomCount = readCount(stream, sizeof(uint32_t));
 	geometrys.resize(geomCount);
 	for (Geometry& it : geometrys) {
-		uint32_t lodCount;
-		readBinary(stream, &lodCount);
+		uint32_t lodCount = readCount(stream, 1);
 		it.lods.resize(lodCount);
 	}
 
 	//Vertex attribute table
-	uint32_t vertexAttributeCount;
-	readBinary(stream, &vertexAttributeCount);
+	uint32_t vertexAttributeCount = readCount(stream, sizeof(VertexAttrib));
 	vertexAttribs.resize(vertexAttributeCount);
 	readBinaryArray(stream, vertexAttribs.data(), vertexAttributeCount);
 
 	//Vertices
 	readBinary(stream, &vertexformat);
 	readBinary(stream, &vertexstride);
-	uint32_t vertexCount;
-	readBinary(stream, &vertexCount);
-	vertices.resize((vertexstride / vertexformat)*vertexCount);
-	readBinaryArray(stream, vertices.data(), vertices.size());
+	if (vertexformat == 0 || vertexstride < vertexformat)
+		throw ConversionError("Invalid vertex stride " + std::to_string(vertexstride));
+	vertexCount = readCount(stream, vertexstride);
+	if (streamBuffers) {
+		source = &stream;
+		vertexDataPos = stream.tellg();
+		if (vertexDataPos < 0)
+			throw ConversionError("Streaming requires a seekable input");
+		stream.seekg(std::streamoff(vertexstride) * vertexCount, std::ios::cur);
+	}
+	else {
+		vertices.resize((vertexstride / vertexformat)*vertexCount);
+		readBinaryArray(stream, vertices.data(), vertices.size());
+	}
+
+	layout.stride = vertexstride / vertexformat;
+	layout.position = findAttribOffset(VertexAttrib::position, VertexAttrib::float3);
+	layout.normal = findAttribOffset(VertexAttrib::normal, VertexAttrib::float3);
+	layout.uv1 = findAttribOffset(VertexAttrib::uv1, VertexAttrib::float2);
+	layout.blendWeight = findAttribOffset(VertexAttrib::blendWeight, VertexAttrib::float1);
+	layout.blendIndices = findAttribOffset(VertexAttrib::blendIndices, VertexAttrib::d3dcolor);
 
 	//Indices
-	uint32_t indexCount;
-	readBinary(stream, &indexCount);
-	indices.resize(indexCount);
-	readBinaryArray(stream, indices.data(), indices.size());
+	indexCount = readCount(stream, sizeof(uint16_t));
+	if (streamBuffers) {
+		indexDataPos = stream.tellg();
+		stream.seekg(std::streamoff(sizeof(uint16_t)) * indexCount, std::ios::cur);
+	}
+	else {
+		indices.resize(indexCount);
+		readBinaryArray(stream, indices.data(), indices.size());
+	}
 }
 
-void Mesh::readMaterial(std::istream& stream, Material& material) const
+uint32_t Mesh::readCount(std::istream& stream, size_t elementBytes) const
 {
-	material.fxFile = readStringFormat2(stream);
-	material.technique = readStringFormat2(stream);
-
-	uint32_t mappingCount;
-	readBinary(stream, &mappingCount);
-	material.map.resize(mappingCount);
-	for (std::string& name : material.map) {
-		name = readStringFormat2(stream);
+	uint32_t count = 0;
+	readBinary(stream, &count);
+	std::streamoff pos = stream.tellg();
+	if (inputEnd >= 0 && pos >= 0 && uint64_t(count) * elementBytes > uint64_t(inputEnd - pos))
+		throw ConversionError("Count " + std::to_string(count) + " does not fit into the rest of the file");
+	return count;
+}
+
+void Mesh::readMaterial(std::istream& stream, Material& material)
+{
+	Trace::Span span{ "Mesh::readMaterial" };
+	material.fxFile = readStringFormat2(stream, arena);
+	material.technique = readStringFormat2(stream, arena);
+
+	uint32_t mappingCount = readCount(stream, sizeof(uint32_t));
+	material.map = arena.allocateArray<StringRef>(mappingCount);
+	for (StringRef& name : material.map) {
+		name = readStringFormat2(stream, arena);
 	}
 
 	readBinary(stream, &material.vertexOffset);
@@ -69,91 +110,251 @@ void Mesh::readMaterial(std::istream& stream, Material& material) const
 
 void Mesh::flipTextureCoords()
 {
-	size_t offset = -1;
-	for (const VertexAttrib& attrib : vertexAttribs) {
-		if (attrib.usage == VertexAttrib::uv1) {
-			offset = attrib.offset / vertexformat;
-			assert(attrib.vartype == VertexAttrib::float2);
-			break;
+	flipTextureCoords(vertices.data(), vertices.size() / layout.stride);
+}
+
+void Mesh::mirrorFix()
+{
+	mirrorFix(vertices.data(), vertices.size() / layout.stride);
+}
+
+void Mesh::flipTextureCoords(float* data, size_t vertexCount) const
+{
+	requireAttrib(layout.uv1, VertexAttrib::uv1);
+
+	dispatchVertexLayout(layout, [data, vertexCount](auto layout) {
+		float* vertex = data;
+		for (size_t i = 0; i < vertexCount; ++i, vertex += layout.stride) {
+			vertex[layout.uv1 + 1] = 1 - vertex[layout.uv1 + 1];	//+1 for the y component
 		}
-	}
-	assert(offset != -1);
+	});
+}
 
-	for (size_t i = offset + 1; i < vertices.size(); i += vertexstride / vertexformat) {	//+1 for the y component
-		vertices[i] = 1 - vertices[i];
-	}
+void Mesh::mirrorFix(float* data, size_t vertexCount) const
+{
+	requireAttrib(layout.position, VertexAttrib::position);
+	requireAttrib(layout.normal, VertexAttrib::normal);
+
+	dispatchVertexLayout(layout, [data, vertexCount](auto layout) {
+		float* vertex = data;
+		for (size_t i = 0; i < vertexCount; ++i, vertex += layout.stride) {
+			vertex[layout.position] = -vertex[layout.position];
+			vertex[layout.normal] = -vertex[layout.normal];
+		}
+	});
 }
 
-void Mesh::mirrorFix()
+void Mesh::writeFiles(const std::string& baseName, OutputSink& sink, ConversionContext& context) const
 {
-	size_t offset = -1;
-	for (const VertexAttrib& attrib : vertexAttribs) {
-		if (attrib.usage == VertexAttrib::position) {
-			offset = attrib.offset / vertexformat;
-			assert(attrib.vartype == VertexAttrib::float3);
-			break;
+	for (size_t geom = 0; geom < geometrys.size(); ++geom) {
+		for (size_t lod = 0; lod < geometrys[geom].lods.size(); ++lod) {
+			std::string name = lodName(baseName, geom, lod) + ".dae";
+
+			rapidxml::xml_document<>& doc = context.newDocument();
+			rapidxml::xml_node<>* root = Utils::createColladaFramework(doc);
+			pendingGeometries.clear();
+			storedGeometries.clear();
+			outputName = name;
+			writeToCollada(context, root, geometrys[geom].lods[lod]);
+
+			if (source)
+				sink.write(name, [this, &context](std::ostream& output) { writeStreamed(output, context); });
+			else
+				sink.write(name, [&doc](std::ostream& output) { output << doc; });
+			writeStoredGeometries(sink, context);
 		}
 	}
-	assert(offset != -1);
+}
+
+void Mesh::writeArrays(const std::string& baseName, OutputSink& sink) const
+{
+	for (size_t geom = 0; geom < geometrys.size(); ++geom) {
+		for (size_t iLod = 0; iLod < geometrys[geom].lods.size(); ++iLod) {
+			const Lod& lod = geometrys[geom].lods[iLod];
+			std::string name = lodName(baseName, geom, iLod);
 
-	for (size_t i = offset; i < vertices.size(); i += vertexstride / vertexformat) {
-		vertices[i] = -vertices[i];
+			NpzWriter npz;
+			rapidjson::StringBuffer json;
+			rapidjson::Writer<rapidjson::StringBuffer> writer{ json };
+			auto writeVec3 = [&writer](const char* key, const glm::vec3& value) {
+				writer.Key(key);
+				writer.StartArray();
+				for (int i = 0; i < 3; ++i) {
+					writer.Double(value[i]);
+				}
+				writer.EndArray();
+			};
+			writer.StartObject();
+			writer.Key("version");
+			writer.Uint(version);
+			writeVec3("min", lod.min);
+			writeVec3("max", lod.max);
+			writer.Key("materials");
+			writer.StartArray();
+			for (size_t iMaterial = 0; iMaterial < lod.materials.size(); ++iMaterial) {
+				const Material& material = lod.materials[iMaterial];
+				std::string objectName = "Object_" + std::to_string(iMaterial);
+				addMaterialArrays(npz, objectName + "_", lod, iMaterial);
+
+				writer.StartObject();
+				writer.Key("name");
+				writer.String(objectName.c_str());
+				writer.Key("fxFile");
+				writer.String(material.fxFile.data, static_cast<rapidjson::SizeType>(material.fxFile.size));
+				writer.Key("technique");
+				writer.String(material.technique.data, static_cast<rapidjson::SizeType>(material.technique.size));
+				writer.Key("textures");
+				writer.StartArray();
+				for (const StringRef& texture : material.map) {
+					writer.String(texture.data, static_cast<rapidjson::SizeType>(texture.size));
+				}
+				writer.EndArray();
+				writer.EndObject();
+			}
+			writer.EndArray();
+			writer.Key("arrays");
+			npz.writeIndex(writer);
+			writer.EndObject();
+
+			sink.write(name + ".npz", [&npz](std::ostream& output) { npz.write(output); });
+			sink.write(name + ".json", [&json](std::ostream& output) { output.write(json.GetString(), json.GetSize()); });
+		}
 	}
+}
 
-	offset = -1;
-	for (const VertexAttrib& attrib : vertexAttribs) {
-		if (attrib.usage == VertexAttrib::normal) {
-			offset = attrib.offset / vertexformat;
-			assert(attrib.vartype == VertexAttrib::float3);
-			break;
+void Mesh::addMaterialArrays(NpzWriter& npz, const std::string& prefix, const Lod& lod, size_t iMaterial) const
+{
+	const Material& material = lod.materials[iMaterial];
+	checkMaterialRange(material);
+	requireAttrib(layout.position, VertexAttrib::position);
+	requireAttrib(layout.normal, VertexAttrib::normal);
+	requireAttrib(layout.uv1, VertexAttrib::uv1);
+
+	size_t count = material.vertexCount;
+	std::vector<float> positions(count * 3);
+	std::vector<float> normals(count * 3);
+	std::vector<float> uvs(count * 2);
+	dispatchVertexLayout(layout, [&](auto layout) {
+		const float* vertex = vertices.data() + size_t(material.vertexOffset) * layout.stride;
+		for (size_t i = 0; i < count; ++i, vertex += layout.stride) {
+			for (size_t k = 0; k < 3; ++k) {
+				positions[i * 3 + k] = vertex[layout.position + k];
+				normals[i * 3 + k] = vertex[layout.normal + k];
+			}
+			uvs[i * 2] = vertex[layout.uv1];
+			uvs[i * 2 + 1] = vertex[layout.uv1 + 1];
 		}
+	});
+
+	//Reverse Vertex Order, the same triangles as the COLLADA export
+	std::vector<uint16_t> triangles(material.indexCount / 3 * 3);
+	const uint16_t* source = indices.data() + material.indexOffset;
+	for (size_t i = 0; i < triangles.size(); i += 3) {
+		triangles[i] = source[i + 2];
+		triangles[i + 1] = source[i + 1];
+		triangles[i + 2] = source[i];
 	}
-	assert(offset != -1);
 
-	for (size_t i = offset; i < vertices.size(); i += vertexstride / vertexformat) {
-		vertices[i] = -vertices[i];
+	npz.add(prefix + "positions", positions.data(), { count, 3 });
+	npz.add(prefix + "normals", normals.data(), { count, 3 });
+	npz.add(prefix + "uvs", uvs.data(), { count, 2 });
+	npz.add(prefix + "triangles", triangles.data(), { triangles.size() / 3, 3 });
+}
+
+void Mesh::checkMaterialRange(const Material& material) const
+{
+	size_t bufferVertices = source ? vertexCount : vertices.size() / layout.stride;
+	size_t bufferIndices = source ? indexCount : indices.size();
+	if (size_t(material.vertexOffset) + material.vertexCount > bufferVertices || size_t(material.indexOffset) + material.indexCount > bufferIndices)
+		throw ConversionError("Material range is outside of the vertex or index buffer");
+}
+
+Mesh::MaterialData Mesh::loadMaterial(const Material& material, std::vector<float>& vertexScratch, std::vector<uint16_t>& indexScratch) const
+{
+	checkMaterialRange(material);
+	if (!source)
+		return MaterialData{ vertices.data() + size_t(material.vertexOffset) * layout.stride, indices.data() + material.indexOffset };
+
+	//Only this material's part of the buffers is in memory
+	vertexScratch.resize(size_t(material.vertexCount) * layout.stride);
+	source->clear();
+	source->seekg(vertexDataPos + std::streamoff(material.vertexOffset) * vertexstride);
+	readBinaryArray(*source, vertexScratch.data(), vertexScratch.size());
+	indexScratch.resize(material.indexCount);
+	source->seekg(indexDataPos + std::streamoff(material.indexOffset) * std::streamoff(sizeof(uint16_t)));
+	readBinaryArray(*source, indexScratch.data(), indexScratch.size());
+	if (!source->good())
+		throw ConversionError("Unexpected end of file in material data");
+	//The same fixes the constructors apply to loaded buffers
+	flipTextureCoords(vertexScratch.data(), material.vertexCount);
+	mirrorFix(vertexScratch.data(), material.vertexCount);
+	return MaterialData{ vertexScratch.data(), indexScratch.data() };
+}
+
+std::string Mesh::lodName(const std::string& baseName, size_t geom, size_t lod) const
+{
+	std::string name = baseName;
+	if (geometrys.size() > 1) {
+		name.append(std::to_string(geom));
 	}
+	if (geometrys[geom].lods.size() > 1) {
+		name.append("_lod");
+		name.append(std::to_string(lod));
+	}
+	return name;
 }
 
-void Mesh::writeFiles(const std::string& baseName) const
+uint32_t Mesh::findAttribOffset(VertexAttrib::Usage usage, VertexAttrib::Vartype vartype) const
 {
-	for (size_t geom = 0; geom < geometrys.size(); ++geom) {
-		for (size_t lod = 0; lod < geometrys[geom].lods.size(); ++lod) {
-			std::string name = baseName;
-			if (geometrys.size() > 1) {
-				name.append(std::to_string(geom));
-			}
-			if (geometrys[geom].lods.size() > 1) {
-				name.append("_lod");
-				name.append(std::to_string(lod));
-			}
-			name.append(".dae");
+	for (const VertexAttrib& attrib : vertexAttribs) {
+		if (attrib.usage != usage)
+			continue;
+		if (attrib.vartype != vartype)
+			return VertexLayout::missing;
+		uint32_t components = vartype == VertexAttrib::d3dcolor ? 1 : vartype + 1;
+		uint32_t offset = attrib.offset / vertexformat;
+		if (offset + components > vertexstride / vertexformat)
+			throw ConversionError("Vertex attribute " + std::to_string(usage) + " is outside of the vertex stride");
+		return offset;
+	}
+	return VertexLayout::missing;
+}
 
-			auto doc = std::make_unique<rapidxml::xml_document<>>();
-			rapidxml::xml_node<>* root = Utils::createColladaFramework(*doc);
-			writeToCollada(*doc, root, geometrys[geom].lods[lod]);
+void Mesh::requireAttrib(uint32_t offset, VertexAttrib::Usage usage) const
+{
+	if (offset == VertexLayout::missing)
+		throw ConversionError("Mesh has no vertex attribute " + std::to_string(usage));
+}
 
-			std::ofstream output{ name };
-			std::cout << "   -->" << name << std::endl;
-			if (!output.good())
-				throw Utils::ConversionError("Can not write to output file " + name);
-			output << *doc;
-		}
+char* Mesh::writeGeometry(ConversionContext& context, xml_node<>* libraryGeometries, const std::string& objectName, const Material& material) const
+{
+	xml_document<>& doc = context.document();
+	if (source) {
+		pendingGeometries.emplace_back(objectName, &material);
+		libraryGeometries->append_node(doc.allocate_node(node_comment, nullptr, "geometry"));
+		std::string meshId = "#" + objectName + "-mesh";
+		return doc.allocate_string(meshId.c_str(), meshId.length() + 1);
 	}
+
+	MaterialData data{ vertices.data() + size_t(material.vertexOffset) * layout.stride, indices.data() + material.indexOffset };
+	return writeGeometry(context, libraryGeometries, objectName, material, data);
 }
 
-char* Mesh::writeGeometry(xml_document<>& doc, xml_node<>* libraryGeometries, const std::string& objectName, const Material& material) const
+char* Mesh::writeGeometry(ConversionContext& context, xml_node<>* libraryGeometries, const std::string& objectName, const Material& material,
+	const MaterialData& data) const
 {
+	Trace::Span span{ "Mesh::writeGeometry" };
+	xml_document<>& doc = context.document();
 	xml_node<>* geometry = doc.allocate_node(node_element, "geometry");
 	char* meshId = setId(doc, geometry, objectName + "-mesh");
 	{
 		xml_node<>* mesh = doc.allocate_node(node_element, "mesh");
 		{
-			std::pair<char*, size_t> positionData = writeVertexData(doc, material, VertexAttrib::position);
+			std::pair<char*, size_t> positionData = writeVertexData(context, material, data, VertexAttrib::position);
 			char* positionsId = writeSourceNode(doc, mesh, objectName + "-mesh-positions", positionData.first, positionData.second, Format::xyz);
-			std::pair<char*, size_t> normalData = writeVertexData(doc, material, VertexAttrib::normal);
+			std::pair<char*, size_t> normalData = writeVertexData(context, material, data, VertexAttrib::normal);
 			char* normalsId = writeSourceNode(doc, mesh, objectName + "-mesh-normals", normalData.first, normalData.second, Format::xyz);
-			std::pair<char*, size_t> texData = writeVertexData(doc, material, VertexAttrib::uv1);
+			std::pair<char*, size_t> texData = writeVertexData(context, material, data, VertexAttrib::uv1);
 			char* texId = writeSourceNode(doc, mesh, objectName + "-mesh-map", texData.first, texData.second, Format::st);
 
 			xml_node<>* vertices = doc.allocate_node(node_element, "vertices");
@@ -170,7 +371,7 @@ char* Mesh::writeGeometry(xml_document<>& doc, xml_node<>* libraryGeometries, co
 			{
 				size_t polyCount;
 				char* indexData;
-				std::tie(indexData, polyCount) = computeIndices(doc, material, 3);
+				std::tie(indexData, polyCount) = computeIndices(context, material, data, 3);
 				polylist->append_attribute(doc.allocate_attribute("count", doc.allocate_string(std::to_string(polyCount).c_str())));
 
 				xml_node<> *input = doc.allocate_node(node_element, "input");
@@ -189,7 +390,7 @@ char* Mesh::writeGeometry(xml_document<>& doc, xml_node<>* libraryGeometries, co
 				input->append_attribute(doc.allocate_attribute("offset", "2"));
 				polylist->append_node(input);
 
-				polylist->append_node(doc.allocate_node(node_element, "vcount", writeValueNtimes(doc, polyCount, "3")));
+				polylist->append_node(doc.allocate_node(node_element, "vcount", writeValueNtimes(context, polyCount, "3")));
 				polylist->append_node(doc.allocate_node(node_element, "p", indexData));
 			}
 			mesh->append_node(polylist);
@@ -200,66 +401,131 @@ char* Mesh::writeGeometry(xml_document<>& doc, xml_node<>* libraryGeometries, co
 	return meshId;
 }
 
-std::pair<char*, size_t> Mesh::writeVertexData(xml_document<>& doc, const Material& material, VertexAttrib::Usage usage) const
+char* Mesh::writeSharedGeometry(ConversionContext& context, xml_node<>* libraryGeometries, const std::string& objectName,
+	const Material& material) const
+{
+	GeometryStore* store = context.geometryStore;
+	if (!store)
+		return writeGeometry(context, libraryGeometries, objectName, material);
+
+	std::vector<uint16_t> materialIndices;
+	MaterialData data = loadMaterial(material, context.floats, materialIndices);
+	bool write;
+	std::string key = store->add(layout, data.vertices, material.vertexCount, data.indices, material.indexCount, write);
+	context.geometryReferences.push_back(key);
+	//Written once per file, even if several lods reference it
+	if (write && std::find(context.geometryFiles.begin(), context.geometryFiles.end(), key) == context.geometryFiles.end()) {
+		context.geometryFiles.push_back(key);
+		storedGeometries.emplace_back(key, &material);
+	}
+	std::string url = store->url(outputName, key);
+	return context.document().allocate_string(url.c_str(), url.length() + 1);
+}
+
+void Mesh::writeStoredGeometries(OutputSink& sink, ConversionContext& context) const
+{
+	std::vector<uint16_t> materialIndices;
+	for (size_t i = 0; i < storedGeometries.size(); ++i) {
+		const std::string& key = storedGeometries[i].first;
+		xml_document<>& doc = context.newDocument();
+		xml_node<>* root = createColladaFramework(doc);
+		MaterialData data = loadMaterial(*storedGeometries[i].second, context.floats, materialIndices);
+		writeGeometry(context, root->first_node("library_geometries"), key, *storedGeometries[i].second, data);
+		sink.write(context.geometryStore->fileName(key), [&doc](std::ostream& output) { output << doc; });
+	}
+}
+
+std::pair<char*, size_t> Mesh::writeVertexData(ConversionContext& context, const Material& material, const MaterialData& data,
+	VertexAttrib::Usage usage) const
 {
-	size_t offset = -1;
+	uint32_t offset;
 	size_t elementCount;
-	for (const VertexAttrib& attrib : vertexAttribs) {
-		if (attrib.usage == usage) {
-			offset = attrib.offset / vertexformat;
-			switch (attrib.vartype) {
-			case VertexAttrib::float1: elementCount = 1; break;
-			case VertexAttrib::float2: elementCount = 2; break;
-			case VertexAttrib::float3: elementCount = 3; break;
-			}
-			break;
-		}
+	switch (usage) {
+	case VertexAttrib::position: offset = layout.position; elementCount = 3; break;
+	case VertexAttrib::normal: offset = layout.normal; elementCount = 3; break;
+	case VertexAttrib::uv1: offset = layout.uv1; elementCount = 2; break;
+	default: offset = VertexLayout::missing; elementCount = 0; break;
 	}
-	assert(offset != -1);
+	requireAttrib(offset, usage);
 
-	std::stringstream ss;
-	size_t count = 0;
-	for (size_t i = 0; i < material.vertexCount; ++i) {
-		for (size_t elem = 0; elem < elementCount; ++elem) {
-			ss << vertices[(material.vertexOffset + i)*vertexstride / vertexformat + offset + elem] << " ";
+	std::string& text = context.text();
+	dispatchVertexLayout(layout, [&](auto layout) {
+		const float* vertex = data.vertices + offset;
+		for (size_t i = 0; i < material.vertexCount; ++i, vertex += layout.stride) {
+			for (size_t elem = 0; elem < elementCount; ++elem) {
+				appendFloat(text, vertex[elem]);
+			}
 		}
-		++count;
-	}
-	std::string result = ss.str();
-	result.pop_back();
-	return std::pair<char*, size_t>(doc.allocate_string(result.c_str(), result.length() + 1), count);
+	});
+	return std::pair<char*, size_t>(allocateText(context.document(), text), material.vertexCount);
 }
 
-char* Mesh::writeValueNtimes(rapidxml::xml_document<>& doc, size_t count, char* value) const
+char* Mesh::writeValueNtimes(ConversionContext& context, size_t count, const char* value) const
 {
-	std::stringstream ss;
+	std::string& text = context.text();
 	for (size_t i = 0; i < count; ++i) {
-		ss << value << " ";
+		text.append(value);
+		text.push_back(' ');
 	}
-	std::string result = ss.str();
-	result.pop_back();
-	return doc.allocate_string(result.c_str(), result.length() + 1);
+	return allocateText(context.document(), text);
 }
 
-std::pair<char*, size_t> Mesh::computeIndices(rapidxml::xml_document<>& doc, const Material& material, size_t inputCount) const
+std::pair<char*, size_t> Mesh::computeIndices(ConversionContext& context, const Material& material, const MaterialData& data,
+	size_t inputCount) const
 {
-	std::stringstream ss;
+	std::string& text = context.text();
 	size_t polycount = 0;
 	for (size_t i = 0; i < material.indexCount; i += 3) {
 		//Reverse Vertex Order
 		for (size_t input = 0; input < inputCount; ++input) {
-			ss << indices[material.indexOffset + i + 2] << " ";
+			appendIndex(text, data.indices[i + 2]);
 		}
 		for (size_t input = 0; input < inputCount; ++input) {
-			ss << indices[material.indexOffset + i + 1] << " ";
+			appendIndex(text, data.indices[i + 1]);
 		}
 		for (size_t input = 0; input < inputCount; ++input) {
-			ss << indices[material.indexOffset + i] << " ";
+			appendIndex(text, data.indices[i]);
 		}
 	}
 	polycount += material.indexCount / 3;
 
-	std::string result = ss.str();
-	result.pop_back();
-	return std::pair<char*, size_t>(doc.allocate_string(result.c_str(), result.length() + 1), polycount);
-}
\ No newline at end of file
+	return std::pair<char*, size_t>(allocateText(context.document(), text), polycount);
+}
+
+void Mesh::writeStreamed(std::ostream& output, ConversionContext& context) const
+{
+	std::string document;
+	rapidxml::print(std::back_inserter(document), context.document());
+
+	const std::string placeholder = "<!--geometry-->";
+	std::vector<float>& materialVertices = context.floats;
+	std::vector<uint16_t> materialIndices;
+	std::string geometryText;
+	size_t written = 0;
+	for (const auto& pending : pendingGeometries) {
+		size_t found = document.find(placeholder, written);
+		assert(found != std::string::npos);
+		size_t lineStart = document.rfind('\n', found) + 1;
+		output.write(document.data() + written, lineStart - written);
+		written = found + placeholder.length() + 1;	//+1 for the newline
+
+		const Material& material = *pending.second;
+		MaterialData data = loadMaterial(material, materialVertices, materialIndices);
+
+		xml_document<>& doc = context.newDocument();
+		xml_node<>* libraryGeometries = doc.allocate_node(node_element, "library_geometries");
+		writeGeometry(context, libraryGeometries, pending.first, material, data);
+
+		//Printed on its own the geometry starts at column 0, every line gets the indentation of the placeholder
+		geometryText.clear();
+		rapidxml::print(std::back_inserter(geometryText), *libraryGeometries->first_node());
+		std::string indent = document.substr(lineStart, found - lineStart);
+		for (size_t line = 0, next; line < geometryText.size(); line = next) {
+			next = geometryText.find('\n', line);
+			next = next == std::string::npos ? geometryText.size() : next + 1;
+			output << indent;
+			output.write(geometryText.data() + line, next - line);
+		}
+	}
+	output.write(document.data() + written, document.size() - written);
+}
@@ -1,22 +1,31 @@
 #pragma once
 #include "Utils.h"
+#include "OutputSink.h"
+#include "ConversionContext.h"
+#include "VertexLayout.h"
+#include "NpzWriter.h"
+#include "GeometryStore.h"
 
 class Mesh
 {
 public:
-	Mesh(std::istream& stream);
+	// With streamBuffers the vertex and index buffers are not loaded, writeFiles reads one material at a time from stream
+	// while it writes the output. stream must be seekable and stay open until the mesh is destroyed
+	Mesh(std::istream& stream, bool streamBuffers = false);
 	virtual ~Mesh() = default;
 
-	void writeFiles(const std::string& baseName) const;
+	void writeFiles(const std::string& baseName, OutputSink& sink, ConversionContext& context) const;
+	// Writes the decoded attributes and indices of every lod as .npz with a .json sidecar
+	void writeArrays(const std::string& baseName, OutputSink& sink) const;
 
 protected:
 	struct Material {
 		enum Alphamode : uint32_t { opaque = 0, blend = 1, alphatest = 2 };
 		Alphamode alphamode;
-		std::string fxFile;
-		std::string technique;
+		StringRef fxFile;
+		StringRef technique;
 
-		std::vector<std::string> map;
+		Span<StringRef> map;
 
 		uint32_t vertexOffset;
 		uint32_t indexOffset;
@@ -28,19 +37,24 @@ protected:
 		glm::mat4 matrix;
 	};
 	struct Rig {
-		std::vector<MeshBone> bones;
+		Span<MeshBone> bones;
 	};
 	struct Lod {
 		glm::vec3 min;
 		glm::vec3 max;
 		glm::vec3 pivot;
-		std::vector<Rig> rigs;
-		std::vector<glm::mat4> nodes;
-		std::vector<Material> materials;
+		Span<Rig> rigs;
+		Span<glm::mat4> nodes;
+		Span<Material> materials;
 	};
 	struct Geometry {
 		std::vector<Lod> lods;
 	};
+	// Vertices and indices of one material
+	struct MaterialData {
+		const float* vertices;
+		const uint16_t* indices;
+	};
 	struct VertexAttrib {
 		uint16_t flag;
 		uint16_t offset;
@@ -51,22 +65,73 @@ protected:
 		Usage usage;
 	};
 
-	virtual void readMaterial(std::istream& stream, Material& material) const;
+	// Smallest material in a file: two empty strings, the mapping count and the vertex and index ranges
+	static const size_t minMaterialBytes = 28;
+
+	// Reads an element count, throws if the rest of the input is too short for count elements of at least elementBytes each
+	uint32_t readCount(std::istream& stream, size_t elementBytes) const;
+	virtual void readMaterial(std::istream& stream, Material& material);
 	void flipTextureCoords();
 	void mirrorFix();
+	void flipTextureCoords(float* data, size_t vertexCount) const;
+	void mirrorFix(float* data, size_t vertexCount) const;
 
-	virtual void writeToCollada(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* root, const Lod& lod) const = 0;
-	char* writeGeometry(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* libraryGeometries, const std::string& objectName,
+	std::string lodName(const std::string& baseName, size_t geom, size_t lod) const;
+	// Offset in floats of the attribute with usage, VertexLayout::missing if there is none or it is not stored as vartype
+	uint32_t findAttribOffset(VertexAttrib::Usage usage, VertexAttrib::Vartype vartype) const;
+	// Throws if the attribute at offset is missing
+	void requireAttrib(uint32_t offset, VertexAttrib::Usage usage) const;
+
+	// Writes lod into context.document()
+	virtual void writeToCollada(ConversionContext& context, rapidxml::xml_node<>* root, const Lod& lod) const = 0;
+	// Returns the url of the geometry. In streaming mode only a placeholder is added, which writeStreamed replaces
+	char* writeGeometry(ConversionContext& context, rapidxml::xml_node<>* libraryGeometries, const std::string& objectName,
+		const Material& material) const;
+	char* writeGeometry(ConversionContext& context, rapidxml::xml_node<>* libraryGeometries, const std::string& objectName,
+		const Material& material, const MaterialData& data) const;
+	// Same as writeGeometry, but with a geometry store in context the geometry is only referenced. New geometries of the store are written by writeFiles
+	char* writeSharedGeometry(ConversionContext& context, rapidxml::xml_node<>* libraryGeometries, const std::string& objectName,
 		const Material& material) const;
-	std::pair<char*, size_t> writeVertexData(rapidxml::xml_document<>& doc, const Material& material, VertexAttrib::Usage usage) const;
-	char* writeValueNtimes(rapidxml::xml_document<>& doc, size_t count, char* value) const;
-	std::pair<char*, size_t> computeIndices(rapidxml::xml_document<>& doc, const Material& material, size_t inputCount) const;
+	// Writes the store files of the geometries of the last lod that are not stored yet
+	void writeStoredGeometries(OutputSink& sink, ConversionContext& context) const;
+	std::pair<char*, size_t> writeVertexData(ConversionContext& context, const Material& material, const MaterialData& data,
+		VertexAttrib::Usage usage) const;
+	char* writeValueNtimes(ConversionContext& context, size_t count, const char* value) const;
+	std::pair<char*, size_t> computeIndices(ConversionContext& context, const Material& material, const MaterialData& data,
+		size_t inputCount) const;
 
+	// Adds the arrays of one material, their names start with prefix
+	virtual void addMaterialArrays(NpzWriter& npz, const std::string& prefix, const Lod& lod, size_t iMaterial) const;
+	void checkMaterialRange(const Material& material) const;
+	// Points into the buffers, in streaming mode the material is read into vertexScratch and indexScratch first
+	MaterialData loadMaterial(const Material& material, std::vector<float>& vertexScratch, std::vector<uint16_t>& indexScratch) const;
+
+	// Prints the document of one lod and writes the placeholders of its geometries one material at a time
+	void writeStreamed(std::ostream& output, ConversionContext& context) const;
+
+	//Parsed strings and per lod arrays, released together with the mesh
+	Arena arena;
 	uint32_t version;
 	std::vector<Geometry> geometrys;
 	std::vector<VertexAttrib> vertexAttribs;
 	uint32_t vertexformat;
 	uint32_t vertexstride;
+	//Resolved once, vertex loops go through dispatchVertexLayout
+	VertexLayout layout;
 	std::vector<float> vertices;
 	std::vector<uint16_t> indices;
+
+	//End of the input, -1 if it is not seekable
+	std::streamoff inputEnd = -1;
+	//Streaming mode: the buffers stay in source at these positions
+	std::istream* source = nullptr;
+	std::streamoff vertexDataPos = 0;
+	std::streamoff indexDataPos = 0;
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0;
+	//Geometries of the lod being written, in the order of their placeholders
+	mutable std::vector<std::pair<std::string, const Material*>> pendingGeometries;
+	//Output name of the lod being written and the store geometries it has to write, by key
+	mutable std::string outputName;
+	mutable std::vector<std::pair<std::string, const Material*>> storedGeometries;
 };
@@ -0,0 +1,164 @@
+#include "NpzWriter.h"
+#include <array>
+#include <cstring>
+#include <limits>
+#include "Utils.h"
+
+using namespace Utils;
+
+namespace {
+	uint32_t crc32(const char* data, size_t size)
+	{
+		static const std::array<uint32_t, 256> table = []() {
+			std::array<uint32_t, 256> result;
+			for (uint32_t i = 0; i < 256; ++i) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k) {
+					c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+				}
+				result[i] = c;
+			}
+			return result;
+		}();
+
+		uint32_t crc = 0xFFFFFFFF;
+		for (size_t i = 0; i < size; ++i) {
+			crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+		}
+		return crc ^ 0xFFFFFFFF;
+	}
+
+	//Fields shared by the local and the central zip headers, from version needed to extra field length
+	void writeZipFields(std::ostream& stream, uint32_t crc, uint32_t size, uint16_t nameLength)
+	{
+		writeBinary(stream, uint16_t(10));		//version needed, 1.0 for stored files
+		writeBinary(stream, uint16_t(0));		//flags
+		writeBinary(stream, uint16_t(0));		//stored
+		writeBinary(stream, uint16_t(0));		//time
+		writeBinary(stream, uint16_t(0x21));	//date, 1980-01-01
+		writeBinary(stream, crc);
+		writeBinary(stream, size);				//compressed
+		writeBinary(stream, size);				//uncompressed
+		writeBinary(stream, nameLength);
+		writeBinary(stream, uint16_t(0));		//extra field
+	}
+}
+
+void NpzWriter::add(const std::string& name, const float* data, std::initializer_list<size_t> shape)
+{
+	add(name, "float32", "<f4", data, sizeof(float), shape);
+}
+
+void NpzWriter::add(const std::string& name, const uint8_t* data, std::initializer_list<size_t> shape)
+{
+	add(name, "uint8", "|u1", data, sizeof(uint8_t), shape);
+}
+
+void NpzWriter::add(const std::string& name, const uint16_t* data, std::initializer_list<size_t> shape)
+{
+	add(name, "uint16", "<u2", data, sizeof(uint16_t), shape);
+}
+
+void NpzWriter::add(const std::string& name, const uint32_t* data, std::initializer_list<size_t> shape)
+{
+	add(name, "uint32", "<u4", data, sizeof(uint32_t), shape);
+}
+
+void NpzWriter::add(const std::string& name, const char* dtype, const char* descr, const void* data, size_t elementSize,
+	std::initializer_list<size_t> shape)
+{
+	size_t count = 1;
+	std::string dims;
+	for (size_t dim : shape) {
+		count *= dim;
+		if (!dims.empty())
+			dims += ", ";
+		dims += std::to_string(dim);
+	}
+	if (shape.size() == 1)
+		dims += ",";	//python tuple with one element
+
+	//Format 1.0: magic, version, header length and a python dict padded so the data starts at a multiple of 64
+	std::string header = std::string("{'descr': '") + descr + "', 'fortran_order': False, 'shape': (" + dims + "), }";
+	size_t headerSize = 10 + header.size() + 1;
+	header.append((64 - headerSize % 64) % 64, ' ');
+	header.push_back('\n');
+
+	Array array{ name, dtype, shape, {} };
+	array.npy.reserve(10 + header.size() + count * elementSize);
+	array.npy.append("\x93NUMPY\x01\x00", 8);
+	uint16_t headerLength = static_cast<uint16_t>(header.size());
+	array.npy.append(reinterpret_cast<const char*>(&headerLength), sizeof(headerLength));
+	array.npy.append(header);
+	if (count)
+		array.npy.append(static_cast<const char*>(data), count * elementSize);
+	if (array.npy.size() > std::numeric_limits<uint32_t>::max())
+		throw ConversionError("Array " + name + " is too large for an npz file");
+	arrays.push_back(std::move(array));
+}
+
+void NpzWriter::write(std::ostream& stream) const
+{
+	if (arrays.size() > std::numeric_limits<uint16_t>::max())
+		throw ConversionError("Too many arrays for an npz file");
+
+	std::vector<uint32_t> crcs;
+	std::vector<uint32_t> offsets;
+	uint64_t offset = 0;
+	for (const Array& array : arrays) {
+		std::string filename = array.name + ".npy";
+		crcs.push_back(crc32(array.npy.data(), array.npy.size()));
+		offsets.push_back(static_cast<uint32_t>(offset));
+
+		writeBinary(stream, uint32_t(0x04034b50));
+		writeZipFields(stream, crcs.back(), static_cast<uint32_t>(array.npy.size()), static_cast<uint16_t>(filename.size()));
+		stream.write(filename.data(), filename.size());
+		stream.write(array.npy.data(), array.npy.size());
+		offset += 30 + filename.size() + array.npy.size();
+		if (offset > std::numeric_limits<uint32_t>::max())
+			throw ConversionError("npz file is larger than 4 GB");
+	}
+
+	uint64_t directorySize = 0;
+	for (size_t i = 0; i < arrays.size(); ++i) {
+		std::string filename = arrays[i].name + ".npy";
+		writeBinary(stream, uint32_t(0x02014b50));
+		writeBinary(stream, uint16_t(20));		//version made by
+		writeZipFields(stream, crcs[i], static_cast<uint32_t>(arrays[i].npy.size()), static_cast<uint16_t>(filename.size()));
+		writeBinary(stream, uint16_t(0));		//comment
+		writeBinary(stream, uint16_t(0));		//disk
+		writeBinary(stream, uint16_t(0));		//internal attributes
+		writeBinary(stream, uint32_t(0));		//external attributes
+		writeBinary(stream, offsets[i]);
+		stream.write(filename.data(), filename.size());
+		directorySize += 46 + filename.size();
+	}
+
+	writeBinary(stream, uint32_t(0x06054b50));
+	writeBinary(stream, uint16_t(0));			//disk
+	writeBinary(stream, uint16_t(0));			//disk of the central directory
+	writeBinary(stream, static_cast<uint16_t>(arrays.size()));
+	writeBinary(stream, static_cast<uint16_t>(arrays.size()));
+	writeBinary(stream, static_cast<uint32_t>(directorySize));
+	writeBinary(stream, static_cast<uint32_t>(offset));
+	writeBinary(stream, uint16_t(0));			//comment
+}
+
+void NpzWriter::writeIndex(rapidjson::Writer<rapidjson::StringBuffer>& writer) const
+{
+	writer.StartObject();
+	for (const Array& array : arrays) {
+		writer.Key(array.name.c_str(), static_cast<rapidjson::SizeType>(array.name.size()));
+		writer.StartObject();
+		writer.Key("dtype");
+		writer.String(array.dtype);
+		writer.Key("shape");
+		writer.StartArray();
+		for (size_t dim : array.shape) {
+			writer.Uint64(dim);
+		}
+		writer.EndArray();
+		writer.EndObject();
+	}
+	writer.EndObject();
+}
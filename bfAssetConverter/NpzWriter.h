@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+#include <initializer_list>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+// Typed arrays written as a NumPy .npz archive: a zip without compression that holds one .npy file per array.
+// Data is stored in the byte order of the host, which is little endian on all supported platforms
+class NpzWriter
+{
+public:
+	// The product of shape is the element count of data, the data is copied
+	void add(const std::string& name, const float* data, std::initializer_list<size_t> shape);
+	void add(const std::string& name, const uint8_t* data, std::initializer_list<size_t> shape);
+	void add(const std::string& name, const uint16_t* data, std::initializer_list<size_t> shape);
+	void add(const std::string& name, const uint32_t* data, std::initializer_list<size_t> shape);
+
+	void write(std::ostream& stream) const;
+	// Writes {"<name>": {"dtype": "float32", "shape": [...]}, ...} for a JSON sidecar
+	void writeIndex(rapidjson::Writer<rapidjson::StringBuffer>& writer) const;
+
+private:
+	struct Array {
+		std::string name;
+		const char* dtype;
+		std::vector<size_t> shape;
+		std::string npy;	//complete .npy file
+	};
+
+	void add(const std::string& name, const char* dtype, const char* descr, const void* data, size_t elementSize, std::initializer_list<size_t> shape);
+
+	std::vector<Array> arrays;
+};
@@ -0,0 +1,160 @@
+#include "OutputSink.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include "Utils.h"
+#include "Trace.h"
+
+void OutputSink::writeAll(const std::vector<const OutputFile*>& files)
+{
+	for (const OutputFile* file : files) {
+		write(file->name, [file](std::ostream& stream) { stream.write(file->data.data(), file->data.size()); });
+	}
+}
+
+void FileSink::write(const std::string& name, const std::function<void(std::ostream&)>& writer)
+{
+	if (io) {
+		std::ostringstream output{ std::ios::out | std::ios::binary };
+		{
+			Trace::Span span{ "serialize", &name };
+			writer(output);
+		}
+		OutputFile file{ name, output.str() };
+		writeAll({ &file });
+		return;
+	}
+
+	std::ofstream output{ name, std::ofstream::out | std::ofstream::binary };
+	if (!output.good())
+		throw Utils::ConversionError("Can not write to output file " + name);
+	{
+		Trace::Span span{ "serialize", &name };
+		writer(output);
+	}
+	std::cout << "   -->" << name << std::endl;
+}
+
+void FileSink::writeAll(const std::vector<const OutputFile*>& files)
+{
+	if (!io) {
+		OutputSink::writeAll(files);
+		return;
+	}
+
+	std::vector<std::string> errors;
+	{
+		Trace::Span span{ "writeFiles" };
+		errors = io->writeFiles(files);
+	}
+	std::string message;
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (errors[i].empty())
+			std::cout << "   -->" << files[i]->name << std::endl;
+		else
+			message += (message.empty() ? "" : ", ") + errors[i];
+	}
+	if (!message.empty())
+		throw Utils::ConversionError(message);
+}
+
+void StreamSink::write(const std::string& name, const std::function<void(std::ostream&)>& writer)
+{
+	std::lock_guard<std::mutex> lock{ mutex };
+	Trace::Span span{ "serialize", &name };
+	writer(stream);
+	if (!stream.good())
+		throw Utils::ConversionError("Can not write " + name + " to the output stream");
+}
+
+TarSink::TarSink(std::ostream& stream)
+	:stream(stream), modificationTime(time(nullptr))
+{
+}
+
+void TarSink::write(const std::string& name, const std::function<void(std::ostream&)>& writer)
+{
+	//The header holds the size, so the file is generated before it is appended
+	std::ostringstream output{ std::ios::out | std::ios::binary };
+	{
+		Trace::Span span{ "serialize", &name };
+		writer(output);
+	}
+	std::string data = output.str();
+
+	std::lock_guard<std::mutex> lock{ mutex };
+	writeHeader(name, data.size());
+	stream.write(data.data(), data.size());
+	const char padding[512] = {};
+	stream.write(padding, (512 - data.size() % 512) % 512);
+	if (!stream.good())
+		throw Utils::ConversionError("Can not write " + name + " to the archive");
+}
+
+void TarSink::finish()
+{
+	std::lock_guard<std::mutex> lock{ mutex };
+	const char endBlocks[1024] = {};
+	stream.write(endBlocks, sizeof(endBlocks));
+	stream.flush();
+}
+
+void TarSink::writeHeader(const std::string& name, size_t size)
+{
+	std::string path = name;
+	std::replace(path.begin(), path.end(), '\\', '/');
+	while (!path.empty() && path.front() == '/') {
+		path.erase(0, 1);
+	}
+
+	//Names longer than 100 characters are split into prefix and name at a folder boundary
+	std::string prefix;
+	if (path.size() > 100) {
+		size_t split = path.find('/', path.size() - 101);
+		if (split == std::string::npos || split > 155)
+			throw Utils::ConversionError("Output name is too long for a tar archive: " + name);
+		prefix = path.substr(0, split);
+		path = path.substr(split + 1);
+	}
+
+	char header[512] = {};
+	memcpy(header, path.data(), path.size());
+	snprintf(header + 100, 8, "%07o", 0644);
+	snprintf(header + 108, 8, "%07o", 0);
+	snprintf(header + 116, 8, "%07o", 0);
+	snprintf(header + 124, 12, "%011llo", static_cast<unsigned long long>(size));
+	snprintf(header + 136, 12, "%011llo", static_cast<unsigned long long>(modificationTime));
+	memset(header + 148, ' ', 8);
+	header[156] = '0';
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+	memcpy(header + 345, prefix.data(), prefix.size());
+
+	unsigned checksum = 0;
+	for (unsigned char c : header) {
+		checksum += c;
+	}
+	snprintf(header + 148, 8, "%06o", checksum);
+	stream.write(header, sizeof(header));
+}
+
+void MemorySink::write(const std::string& name, const std::function<void(std::ostream&)>& writer)
+{
+	std::ostringstream output{ std::ios::out | std::ios::binary };
+	{
+		Trace::Span span{ "serialize", &name };
+		writer(output);
+	}
+	std::lock_guard<std::mutex> lock{ mutex };
+	files.push_back(OutputFile{ name, output.str() });
+}
+
+std::vector<OutputFile> MemorySink::takeFiles()
+{
+	std::lock_guard<std::mutex> lock{ mutex };
+	std::vector<OutputFile> result;
+	result.swap(files);
+	return result;
+}
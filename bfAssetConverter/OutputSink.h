@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <ostream>
+#include <functional>
+#include <mutex>
+#include <ctime>
+#include "FileIo.h"
+
+struct OutputFile {
+	std::string name;
+	std::string data;
+};
+
+// Destination of the files produced by a conversion
+class OutputSink
+{
+public:
+	virtual ~OutputSink() = default;
+
+	// Calls writer with a stream for the output file name. May be called from several threads at once
+	virtual void write(const std::string& name, const std::function<void(std::ostream&)>& writer) = 0;
+	// Writes outputs that are already in memory, sinks can override it to write them as one batch
+	virtual void writeAll(const std::vector<const OutputFile*>& files);
+};
+
+// Writes every output to the file system, name is used as path
+class FileSink :public OutputSink
+{
+public:
+	FileSink() = default;
+	// Outputs go through io, which may batch them
+	explicit FileSink(FileIo& io)
+		:io(&io) {}
+
+	void write(const std::string& name, const std::function<void(std::ostream&)>& writer) override;
+	void writeAll(const std::vector<const OutputFile*>& files) override;
+
+private:
+	FileIo* io = nullptr;
+};
+
+// Writes the bytes of every output one after another to a stream, e.g. stdout
+class StreamSink :public OutputSink
+{
+public:
+	StreamSink(std::ostream& stream)
+		:stream(stream) {}
+
+	void write(const std::string& name, const std::function<void(std::ostream&)>& writer) override;
+
+private:
+	std::mutex mutex;
+	std::ostream& stream;
+};
+
+// Streams all outputs as one ustar archive. finish has to be called after the last output
+class TarSink :public OutputSink
+{
+public:
+	TarSink(std::ostream& stream);
+
+	void write(const std::string& name, const std::function<void(std::ostream&)>& writer) override;
+	void finish();
+
+private:
+	void writeHeader(const std::string& name, size_t size);
+
+	std::mutex mutex;
+	std::ostream& stream;
+	time_t modificationTime;
+};
+
+// Keeps all outputs in memory
+class MemorySink :public OutputSink
+{
+public:
+	void write(const std::string& name, const std::function<void(std::ostream&)>& writer) override;
+
+	const std::vector<OutputFile>& getFiles() const { return files; }
+	std::vector<OutputFile> takeFiles();
+
+private:
+	std::mutex mutex;
+	std::vector<OutputFile> files;
+};
@@ -0,0 +1,161 @@
+#include "Pipeline.h"
+#include <map>
+#include <set>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "BoundedQueue.h"
+#include "Trace.h"
+#include "GeometryStore.h"
+
+using namespace Utils;
+
+namespace {
+	struct Input {
+		size_t index;
+		std::string data;
+		std::string error;
+	};
+
+	struct Result {
+		size_t index;
+		std::vector<OutputFile> files;
+		std::string error;
+		std::vector<std::string> geometryReferences;
+		std::vector<std::string> geometryFiles;
+	};
+
+	// Pops from queue until it is closed and empty
+	template<typename T, typename Func> void consume(BoundedQueue<T>& queue, Func func)
+	{
+		T item;
+		while (queue.pop(item)) {
+			func(item);
+		}
+	}
+}
+
+void runPipeline(const std::vector<ConversionJob>& jobs, const std::string& format, const Skeleton* skeleton, const AnimationList& animations,
+	OutputSink& sink, FileIo& io, unsigned workerCount, std::ostream& log, std::ostream& errorLog, GeometryStore* geometryStore)
+{
+	workerCount = std::max(1u, workerCount);
+	size_t window = 2 * workerCount;
+	BoundedQueue<Input> inputs{ window };
+	BoundedQueue<Result> results{ window };
+	std::atomic<unsigned> activeWorkers{ workerCount };
+	std::atomic<size_t> written{ 0 };
+	std::mutex writtenMutex;
+	std::condition_variable writtenChanged;
+
+	std::thread reader{ [&]() {
+		Trace::setThreadName("reader");
+		size_t next = 0;
+		while (next < jobs.size()) {
+			//Memory stays bounded because the reader never runs more than window jobs ahead of the writer
+			size_t end;
+			{
+				std::unique_lock<std::mutex> lock{ writtenMutex };
+				writtenChanged.wait(lock, [&]() { return written.load() + window > next; });
+				end = std::min(jobs.size(), written.load() + window);
+			}
+
+			std::vector<std::string> filenames;
+			for (size_t i = next; i < end; ++i) {
+				filenames.push_back(jobs[i].input);
+			}
+			std::vector<ReadResult> files;
+			{
+				Trace::Span span{ "readFiles" };
+				files = io.readFiles(filenames);
+			}
+			for (size_t i = next; i < end; ++i) {
+				ReadResult& file = files[i - next];
+				inputs.push(Input{ i, std::move(file.data), file.error });
+			}
+			next = end;
+		}
+		inputs.close();
+	} };
+
+	//The cores are split between the workers, so parallel stages of a conversion do not start more threads than there are cores
+	unsigned parallelThreadsPerWorker = std::max(1u, parallelThreads() / workerCount);
+	auto worker = [&]() {
+		Trace::setThreadName("worker");
+		setParallelThreads(parallelThreadsPerWorker);
+		ConversionContext context;
+		context.geometryStore = geometryStore;
+		consume(inputs, [&](Input& input) {
+			Result result{ input.index, {}, input.error, {}, {} };
+			if (result.error.empty()) {
+				const ConversionJob& job = jobs[input.index];
+				Trace::Span span{ "convert", &job.input };
+				try {
+					result.files = convertBuffer(context, input.data.data(), input.data.size(), job.output, getExtension(job.input), format, skeleton, animations);
+					result.geometryReferences = std::move(context.geometryReferences);
+					result.geometryFiles = std::move(context.geometryFiles);
+				}
+				catch (std::exception& e) {
+					result.error = e.what();
+				}
+			}
+			input.data.clear();
+			results.push(std::move(result));
+		});
+		if (--activeWorkers == 0)
+			results.close();
+	};
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < workerCount; ++i) {
+		workers.emplace_back(worker);
+	}
+
+	//Results arrive in any order, the writer holds them back until all earlier jobs are written
+	Trace::setThreadName("writer");
+	std::map<size_t, Result> pending;
+	std::exception_ptr writeError;
+	consume(results, [&](Result& result) {
+		pending[result.index] = std::move(result);
+		for (auto it = pending.find(written.load()); it != pending.end(); it = pending.find(written.load())) {
+			const ConversionJob& job = jobs[it->first];
+			log << "Converting " << job.input << std::endl;
+			if (!it->second.error.empty())
+				errorLog << "Error at file " << job.input << ": " << it->second.error << std::endl;
+			//Geometries that an earlier job stored while this one was converted are not written again
+			std::set<std::string> skipped;
+			for (const std::string& key : it->second.geometryFiles) {
+				if (geometryStore->isStored(key))
+					skipped.insert(geometryStore->fileName(key));
+			}
+			std::vector<const OutputFile*> files;
+			for (const OutputFile& file : it->second.files) {
+				if (!skipped.count(file.name))
+					files.push_back(&file);
+			}
+			try {
+				Trace::Span span{ "writeOutputs", &job.input };
+				sink.writeAll(files);
+				if (geometryStore && it->second.error.empty())
+					geometryStore->commit(it->second.geometryReferences, it->second.geometryFiles);
+			}
+			catch (ConversionError& e) {
+				errorLog << "Error at file " << job.input << ": " << e.what() << std::endl;
+			}
+			catch (...) {
+				if (!writeError)
+					writeError = std::current_exception();
+			}
+			pending.erase(it);
+			std::lock_guard<std::mutex> lock{ writtenMutex };
+			++written;
+			writtenChanged.notify_one();
+		}
+	});
+
+	reader.join();
+	for (std::thread& thread : workers) {
+		thread.join();
+	}
+	if (writeError)
+		std::rethrow_exception(writeError);
+}
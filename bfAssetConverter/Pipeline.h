@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <ostream>
+#include "Converter.h"
+#include "FileIo.h"
+
+struct ConversionJob {
+	std::string input;
+	std::string output;
+};
+
+// Converts jobs in three overlapping stages connected by bounded queues: a reader prefetches batches of input files through io,
+// workers convert them in memory and a writer hands the outputs to sink in job order.
+// At most 2 * workerCount inputs are in flight. Progress is written to log and failed jobs to errorLog, both in job order.
+// geometryStore is shared by all workers if it is set
+void runPipeline(const std::vector<ConversionJob>& jobs, const std::string& format, const Skeleton* skeleton, const AnimationList& animations,
+	OutputSink& sink, FileIo& io, unsigned workerCount, std::ostream& log, std::ostream& errorLog, GeometryStore* geometryStore = nullptr);
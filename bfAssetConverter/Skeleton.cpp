@@ -1,4 +1,5 @@
 #include "Skeleton.h"
+#include "Trace.h"
 #include <glm/gtc/matrix_transform.hpp>
 
 using namespace Utils;
@@ -6,6 +7,7 @@ using namespace rapidxml;
 
 Skeleton::Skeleton(std::istream& stream)
 {
+	Trace::Span span{ "Skeleton::Skeleton" };
 	readBinary(stream, &version);
 	if (version != 2)
 		throw Utils::ConversionError("Version is not supported");
@@ -18,8 +20,10 @@ Skeleton::Skeleton(std::istream& stream)
 	}
 }
 
-void Skeleton::writeToCollada(xml_document<>& doc, xml_node<>* root) const
+void Skeleton::writeToCollada(ConversionContext& context, xml_node<>* root) const
 {
+	Trace::Span span{ "Skeleton::writeToCollada" };
+	xml_document<>& doc = context.document();
 	std::vector<xml_node<>*> parents(bones.size());
 
 	xml_node<>* armature = createArmatureNode(doc, root);
@@ -36,7 +40,7 @@ void Skeleton::writeToCollada(xml_document<>& doc, xml_node<>* root) const
 		node->append_attribute(doc.allocate_attribute("type", "JOINT"));
 
 		glm::mat4 boneMat = glm::translate(glm::mat4(), bone.position) * glm::mat4_cast(bone.rotation);
-		xml_node<>* matrix = doc.allocate_node(node_element, "matrix", matrixToString(doc, boneMat));
+		xml_node<>* matrix = doc.allocate_node(node_element, "matrix", matrixToString(context, boneMat));
 		matrix->append_attribute(doc.allocate_attribute("sid", "transform"));
 		node->append_node(matrix);
 
@@ -1,5 +1,6 @@
 #pragma once
 #include "Utils.h"
+#include "ConversionContext.h"
 
 class Skeleton
 {
@@ -7,7 +8,7 @@ public:
 	Skeleton(std::istream& stream);
 	~Skeleton() = default;
 
-	void writeToCollada(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* root) const;
+	void writeToCollada(ConversionContext& context, rapidxml::xml_node<>* root) const;
 
 private:
 	struct Bone {
@@ -1,15 +1,24 @@
 #include "SkinnedMesh.h"
+#include "Trace.h"
 #include <map>
 #include <sstream>
+#include <fstream>
+#include <iostream>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtx/matrix_decompose.hpp>
 
+#if defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define SKINNING_SSE
+#endif
+
 using namespace Utils;
 using namespace rapidxml;
 
 SkinnedMesh::SkinnedMesh(std::istream& stream, const Skeleton& skeleton)
 	:Mesh(stream), skeleton(skeleton)
 {
+	Trace::Span span{ "SkinnedMesh::SkinnedMesh" };
 	//Rigs
 	for (Geometry& geom : geometrys) {
 		for (Lod& lod : geom.lods) {
@@ -20,9 +29,8 @@ SkinnedMesh::SkinnedMesh(std::istream& stream, const Skeleton& skeleton)
 	//Triangles
 	for (Geometry& geom : geometrys) {
 		for (Lod& lod : geom.lods) {
-			uint32_t materialCount;
-			readBinary(stream, &materialCount);
-			lod.materials.resize(materialCount);
+			uint32_t materialCount = readCount(stream, minMaterialBytes);
+			lod.materials = arena.allocateArray<Material>(materialCount);
 			for (Material& material : lod.materials) {
 				readMaterial(stream, material);
 			}
@@ -33,9 +41,11 @@ SkinnedMesh::SkinnedMesh(std::istream& stream, const Skeleton& skeleton)
 	mirrorFix();
 }
 
-void SkinnedMesh::writeToCollada(xml_document<>& doc, xml_node<>* root, const Lod& lod) const
+void SkinnedMesh::writeToCollada(ConversionContext& context, xml_node<>* root, const Lod& lod) const
 {
-	skeleton.writeToCollada(doc, root);
+	Trace::Span span{ "SkinnedMesh::writeToCollada" };
+	xml_document<>& doc = context.document();
+	skeleton.writeToCollada(context, root);
 
 	xml_node<>* libraryGeometries = root->first_node("library_geometries");
 	xml_node<>* libraryControllers = root->first_node("library_controllers");
@@ -45,15 +55,47 @@ void SkinnedMesh::writeToCollada(xml_document<>& doc, xml_node<>* root, const Lo
 	for (size_t iMaterial = 0; iMaterial < lod.materials.size(); ++iMaterial) {
 		const Material& material = lod.materials[iMaterial];
 		std::string objectName = "Object_" + std::to_string(objectId);
-		char* meshId = writeGeometry(doc, libraryGeometries, objectName, material);
-		char* skinId = writeSkinController(doc, libraryControllers, objectName, material, lod.rigs[iMaterial], meshId);
+		char* meshId = writeGeometry(context, libraryGeometries, objectName, material);
+		char* skinId = writeSkinController(context, libraryControllers, objectName, material, lod.rigs[iMaterial], meshId);
 		writeSceneObject(doc, visualScene, objectName, skinId);
 		++objectId;
 	}
 }
 
-void SkinnedMesh::readRigs(std::istream& stream, Lod& lod) const
+void SkinnedMesh::addMaterialArrays(NpzWriter& npz, const std::string& prefix, const Lod& lod, size_t iMaterial) const
 {
+	Mesh::addMaterialArrays(npz, prefix, lod, iMaterial);
+	if (iMaterial >= lod.rigs.size())
+		throw ConversionError("Lod has fewer rigs than materials");
+	requireAttrib(layout.blendWeight, VertexAttrib::blendWeight);
+	requireAttrib(layout.blendIndices, VertexAttrib::blendIndices);
+
+	//Two influences per vertex, joints are skeleton bone ids
+	const Material& material = lod.materials[iMaterial];
+	const Rig& rig = lod.rigs[iMaterial];
+	size_t count = material.vertexCount;
+	std::vector<float> weights(count * 2);
+	std::vector<uint32_t> joints(count * 2);
+	dispatchVertexLayout(layout, [&](auto layout) {
+		const float* vertex = vertices.data() + size_t(material.vertexOffset) * layout.stride;
+		for (size_t i = 0; i < count; ++i, vertex += layout.stride) {
+			glm::u8vec4 poseIndices = reinterpret_cast<const glm::u8vec4&>(vertex[layout.blendIndices]);
+			if (poseIndices.x >= rig.bones.size() || poseIndices.y >= rig.bones.size())
+				throw ConversionError("Vertex references a bone which is not in its rig");
+			weights[i * 2] = vertex[layout.blendWeight];
+			weights[i * 2 + 1] = 1 - vertex[layout.blendWeight];
+			joints[i * 2] = rig.bones[poseIndices.x].id;
+			joints[i * 2 + 1] = rig.bones[poseIndices.y].id;
+		}
+	});
+
+	npz.add(prefix + "weights", weights.data(), { count, 2 });
+	npz.add(prefix + "joints", joints.data(), { count, 2 });
+}
+
+void SkinnedMesh::readRigs(std::istream& stream, Lod& lod)
+{
+	Trace::Span span{ "SkinnedMesh::readRigs" };
 	readBinary(stream, &lod.min);
 	readBinary(stream, &lod.max);
 	if (version <= 6)
@@ -62,13 +104,11 @@ void SkinnedMesh::readRigs(std::istream& stream, Lod& lod) const
 	glm::mat4 mirrorMatrix{};
 	mirrorMatrix[0][0] = -1.0f;
 
-	uint32_t rigCount;
-	readBinary(stream, &rigCount);
-	lod.rigs.resize(rigCount);
+	uint32_t rigCount = readCount(stream, sizeof(uint32_t));
+	lod.rigs = arena.allocateArray<Rig>(rigCount);
 	for (Rig& rig : lod.rigs) {
-		uint32_t boneCount;
-		readBinary(stream, &boneCount);
-		rig.bones.resize(boneCount);
+		uint32_t boneCount = readCount(stream, sizeof(uint32_t) + sizeof(glm::mat4));
+		rig.bones = arena.allocateArray<MeshBone>(boneCount);
 		for (MeshBone& bone : rig.bones) {
 			readBinary(stream, &bone.id);
 			readBinary(stream, &bone.matrix);
@@ -82,9 +122,11 @@ void SkinnedMesh::readRigs(std::istream& stream, Lod& lod) const
 	}
 }
 
-char* SkinnedMesh::writeSkinController(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* libraryControllers, const std::string& objectName,
+char* SkinnedMesh::writeSkinController(ConversionContext& context, rapidxml::xml_node<>* libraryControllers, const std::string& objectName,
 	const Material& material, const Rig& rig, const char* meshId) const
 {
+	Trace::Span span{ "SkinnedMesh::writeSkinController" };
+	xml_document<>& doc = context.document();
 	xml_node<>* controller = doc.allocate_node(node_element, "controller");
 	char* skinId = setId(doc, controller, objectName + "-skin");
 	{
@@ -92,14 +134,16 @@ char* SkinnedMesh::writeSkinController(rapidxml::xml_document<>& doc, rapidxml::
 		{
 			skin->append_attribute(doc.allocate_attribute("source", meshId));
 
-			std::pair<char*, size_t> jointData = writeBoneNames(doc, rig);
+			std::pair<char*, size_t> jointData = writeBoneNames(context, rig);
 			char* jointsId = writeSourceNode(doc, skin, objectName + "-skin-joints", jointData.first, jointData.second, Format::joint);
-			std::pair<char*, size_t> poseData = writeBonePoses(doc, rig);
+			std::pair<char*, size_t> poseData = writeBonePoses(context, rig);
 			char* posesId = writeSourceNode(doc, skin, objectName + "-skin-poses", poseData.first, poseData.second, Format::transform);
-			std::vector<float> weightData;
-			std::vector<size_t> indexData;
+			std::vector<float>& weightData = context.floats;
+			std::vector<size_t>& indexData = context.indices;
+			weightData.clear();
+			indexData.clear();
 			size_t vertexCount = computeVertexWeights(material, weightData, indexData);
-			char* weightsId = writeSourceNode(doc, skin, objectName + "-skin-weights", floatsToString(doc, weightData), weightData.size(), Format::weight);
+			char* weightsId = writeSourceNode(doc, skin, objectName + "-skin-weights", floatsToString(context, weightData), weightData.size(), Format::weight);
 
 			xml_node<>* joints = doc.allocate_node(node_element, "joints");
 			{
@@ -128,8 +172,8 @@ char* SkinnedMesh::writeSkinController(rapidxml::xml_document<>& doc, rapidxml::
 				input->append_attribute(doc.allocate_attribute("offset", "1"));
 				vertexWeights->append_node(input);
 
-				vertexWeights->append_node(doc.allocate_node(node_element, "vcount", writeValueNtimes(doc, vertexCount, "2")));
-				vertexWeights->append_node(doc.allocate_node(node_element, "v", indicesToString(doc, indexData)));
+				vertexWeights->append_node(doc.allocate_node(node_element, "vcount", writeValueNtimes(context, vertexCount, "2")));
+				vertexWeights->append_node(doc.allocate_node(node_element, "v", indicesToString(context, indexData)));
 			}
 			skin->append_node(vertexWeights);
 		}
@@ -159,74 +203,166 @@ void SkinnedMesh::writeSceneObject(rapidxml::xml_document<>& doc, rapidxml::xml_
 	visualScene->append_node(node);
 }
 
-std::pair<char*, size_t> SkinnedMesh::writeBoneNames(rapidxml::xml_document<>& doc, const Rig& rig) const
+std::pair<char*, size_t> SkinnedMesh::writeBoneNames(ConversionContext& context, const Rig& rig) const
 {
-	std::stringstream ss;
+	std::string& text = context.text();
 	size_t count = 0;
 	for (const MeshBone& bone : rig.bones) {
-		ss << skeleton.bones[bone.id].name << " ";
+		text.append(skeleton.bones[bone.id].name);
+		text.push_back(' ');
 	}
 	count += rig.bones.size();
 
-	std::string data = ss.str();
-	data.pop_back();
-	return std::pair<char*, size_t>(doc.allocate_string(data.c_str(), data.length() + 1), count);
+	return std::pair<char*, size_t>(allocateText(context.document(), text), count);
 }
 
-std::pair<char*, size_t> SkinnedMesh::writeBonePoses(rapidxml::xml_document<>& doc, const Rig& rig) const
+std::pair<char*, size_t> SkinnedMesh::writeBonePoses(ConversionContext& context, const Rig& rig) const
 {
-	std::stringstream ss;
+	std::string& text = context.text();
 	size_t count = 0;
 	for (const MeshBone& bone : rig.bones) {
-		writeMatrixToStream(ss, bone.matrix);
+		appendMatrix(text, bone.matrix);
 	}
 	count += rig.bones.size();
 
-	std::string data = ss.str();
-	data.pop_back();
-
-	return std::pair<char*, size_t>(doc.allocate_string(data.c_str(), data.length() + 1), count);
+	return std::pair<char*, size_t>(allocateText(context.document(), text), count);
 }
 
 size_t SkinnedMesh::computeVertexWeights(const Material& material, std::vector<float>& weightData, std::vector<size_t>& indexData) const
 {
-	size_t indexOffset = -1;
-	size_t weightOffset = -1;
-	for (const VertexAttrib& attrib : vertexAttribs) {
-		if (attrib.usage == VertexAttrib::blendIndices) {
-			indexOffset = attrib.offset / vertexformat;
+	requireAttrib(layout.blendWeight, VertexAttrib::blendWeight);
+	requireAttrib(layout.blendIndices, VertexAttrib::blendIndices);
+
+	std::map<float, size_t> weightIndexMap;
+	dispatchVertexLayout(layout, [&](auto layout) {
+		const float* vertex = vertices.data() + size_t(material.vertexOffset) * layout.stride;
+		for (size_t i = 0; i < material.vertexCount; ++i, vertex += layout.stride) {
+			float weights[2];
+			weights[0] = vertex[layout.blendWeight];
+			weights[1] = 1 - weights[0];
+			glm::u8vec4 poseIndices = reinterpret_cast<const glm::u8vec4&>(vertex[layout.blendIndices]);
+
+			if (poseIndices.x == poseIndices.y) {	//Don't allow same Index twice -> change the 0 influence to any other
+				if (weights[0] == 1)
+					poseIndices.y = !poseIndices.y;	//1 if 0, 0 else
+				else
+					poseIndices.x = !poseIndices.x;
+			}
+
+			for (size_t w = 0; w < 2; ++w) {
+				indexData.push_back(poseIndices[w]);
+				auto ins = weightIndexMap.insert(std::make_pair(weights[w], weightData.size()));
+				if (ins.second)
+					weightData.push_back(weights[w]);
+				indexData.push_back(ins.first->second);
+			}
 		}
-		if (attrib.usage == VertexAttrib::blendWeight) {
-			weightOffset = attrib.offset / vertexformat;
+	});
+
+	return material.vertexCount;
+}
+
+
+void SkinnedMesh::writeVertexCaches(const std::string& baseName, const std::string& animationName, const Animation& animation, OutputSink& sink,
+	ConversionContext& context) const
+{
+	std::vector<glm::mat4> poses = animation.computeModelSpacePoses();
+	uint32_t frameCount = animation.getFrameCount();
+
+	for (size_t geom = 0; geom < geometrys.size(); ++geom) {
+		for (size_t lod = 0; lod < geometrys[geom].lods.size(); ++lod) {
+			std::vector<float>& positions = context.floats;
+			bakeLod(geometrys[geom].lods[lod], poses, frameCount, positions);
+			uint32_t vertexCount = frameCount ? static_cast<uint32_t>(positions.size() / (3 * frameCount)) : 0;
+
+			std::string name = lodName(baseName, geom, lod) + "_" + animationName + ".bfvc";
+			sink.write(name, [&](std::ostream& output) {
+				output.write("BFVC", 4);
+				writeBinary(output, uint32_t(1));	//cache version
+				writeBinary(output, vertexCount);
+				writeBinary(output, frameCount);
+				writeBinaryArray(output, positions.data(), positions.size());
+			});
 		}
 	}
-	assert(indexOffset != -1 && weightOffset != -1);
+}
 
-	std::map<float, size_t> weightIndexMap;
-	size_t vertexCount = 0;
-	for (size_t i = 0; i < material.vertexCount; ++i) {
-		size_t vertexBase = (material.vertexOffset + i)*vertexstride / vertexformat;
-		std::vector<float> weights(2);
-		weights[0] = vertices[vertexBase + weightOffset];
-		weights[1] = 1 - weights[0];
-		glm::u8vec4 poseIndices = reinterpret_cast<const glm::u8vec4&>(vertices[vertexBase + indexOffset]);
-
-		if (poseIndices.x == poseIndices.y) {	//Don't allow same Index twice -> change the 0 influence to any other
-			if (weights[0] == 1)
-				poseIndices.y = !poseIndices.y;	//1 if 0, 0 else
-			else
-				poseIndices.x = !poseIndices.x;
-		}
+void SkinnedMesh::bakeLod(const Lod& lod, const std::vector<glm::mat4>& poses, uint32_t frameCount, std::vector<float>& result) const
+{
+	if (lod.rigs.size() < lod.materials.size())
+		throw ConversionError("Lod has fewer rigs than materials");
 
-		for (size_t w = 0; w < weights.size(); ++w) {
-			indexData.push_back(poseIndices[w]);
-			auto ins = weightIndexMap.insert(std::make_pair(weights[w], weightData.size()));
-			if (ins.second)
-				weightData.push_back(weights[w]);
-			indexData.push_back(ins.first->second);
+	requireAttrib(layout.position, VertexAttrib::position);
+	requireAttrib(layout.blendWeight, VertexAttrib::blendWeight);
+	requireAttrib(layout.blendIndices, VertexAttrib::blendIndices);
+
+	//Skin matrices of all rigs are stored back to back, so every vertex can address them with one index
+	std::vector<std::pair<uint32_t, const MeshBone*>> skinBones;
+	std::vector<SkinVertex> skinVertices;
+	for (size_t iMaterial = 0; iMaterial < lod.materials.size(); ++iMaterial) {
+		const Material& material = lod.materials[iMaterial];
+		const Rig& rig = lod.rigs[iMaterial];
+		uint32_t rigBase = static_cast<uint32_t>(skinBones.size());
+		for (const MeshBone& bone : rig.bones) {
+			if (bone.id >= skeleton.bones.size())
+				throw ConversionError("Rig references bone " + std::to_string(bone.id) + " which is not in the skeleton");
+			skinBones.emplace_back(bone.id, &bone);
 		}
-		++vertexCount;
+
+		dispatchVertexLayout(layout, [&](auto layout) {
+			const float* source = vertices.data() + size_t(material.vertexOffset) * layout.stride;
+			for (size_t i = 0; i < material.vertexCount; ++i, source += layout.stride) {
+				glm::u8vec4 poseIndices = reinterpret_cast<const glm::u8vec4&>(source[layout.blendIndices]);
+				if (poseIndices.x >= rig.bones.size() || poseIndices.y >= rig.bones.size())
+					throw ConversionError("Vertex references a bone which is not in its rig");
+
+				SkinVertex vertex;
+				vertex.position = glm::vec3{ source[layout.position], source[layout.position + 1], source[layout.position + 2] };
+				vertex.weight = source[layout.blendWeight];
+				vertex.matrix0 = rigBase + poseIndices.x;
+				vertex.matrix1 = rigBase + poseIndices.y;
+				skinVertices.push_back(vertex);
+			}
+		});
 	}
 
-	return vertexCount;
-}
+	size_t vertexCount = skinVertices.size();
+	result.resize(vertexCount * 3 * frameCount);
+	parallelFor(frameCount, [&](size_t firstFrame, size_t lastFrame) {
+		std::vector<glm::mat4> skinMatrices(skinBones.size());
+		for (size_t frame = firstFrame; frame < lastFrame; ++frame) {
+			for (size_t i = 0; i < skinBones.size(); ++i) {
+				skinMatrices[i] = poses[skinBones[i].first * frameCount + frame] * skinBones[i].second->matrix;
+			}
+
+			float* out = &result[frame * vertexCount * 3];
+			for (const SkinVertex& vertex : skinVertices) {
+#ifdef SKINNING_SSE
+				const float* m0 = &skinMatrices[vertex.matrix0][0][0];
+				const float* m1 = &skinMatrices[vertex.matrix1][0][0];
+				__m128 w0 = _mm_set1_ps(vertex.weight);
+				__m128 w1 = _mm_set1_ps(1.0f - vertex.weight);
+				__m128 columns[4];
+				for (int column = 0; column < 4; ++column) {
+					columns[column] = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m0 + column * 4), w0), _mm_mul_ps(_mm_loadu_ps(m1 + column * 4), w1));
+				}
+				__m128 position = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(columns[0], _mm_set1_ps(vertex.position.x)), _mm_mul_ps(columns[1], _mm_set1_ps(vertex.position.y))),
+					_mm_add_ps(_mm_mul_ps(columns[2], _mm_set1_ps(vertex.position.z)), columns[3]));
+				float skinned[4];
+				_mm_storeu_ps(skinned, position);
+				out[0] = skinned[0];
+				out[1] = skinned[1];
+				out[2] = skinned[2];
+#else
+				glm::mat4 blended = skinMatrices[vertex.matrix0] * vertex.weight + skinMatrices[vertex.matrix1] * (1.0f - vertex.weight);
+				glm::vec4 skinned = blended * glm::vec4(vertex.position, 1.0f);
+				out[0] = skinned.x;
+				out[1] = skinned.y;
+				out[2] = skinned.z;
+#endif
+				out += 3;
+			}
+		}
+	});
+}
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include "Skeleton.h"
+#include "Animation.h"
 #include "Mesh.h"
 
 class SkinnedMesh : public Mesh
@@ -8,16 +9,29 @@ public:
 	SkinnedMesh(std::istream& stream, const Skeleton& skeleton);
 	~SkinnedMesh() = default;
 
+	// Bakes the skinned vertex positions of every animation frame into one vertex cache per lod
+	void writeVertexCaches(const std::string& baseName, const std::string& animationName, const Animation& animation, OutputSink& sink,
+		ConversionContext& context) const;
+
 protected:
-	void readRigs(std::istream& stream, Lod& lod) const;
+	void readRigs(std::istream& stream, Lod& lod);
 
-	void writeToCollada(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* root, const Lod& lod) const override;
-	char* writeSkinController(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* libraryControllers, const std::string& objectName,
+	void writeToCollada(ConversionContext& context, rapidxml::xml_node<>* root, const Lod& lod) const override;
+	void addMaterialArrays(NpzWriter& npz, const std::string& prefix, const Lod& lod, size_t iMaterial) const override;
+	char* writeSkinController(ConversionContext& context, rapidxml::xml_node<>* libraryControllers, const std::string& objectName,
 		const Material& material, const Rig& rig, const char* meshId) const;
 	void writeSceneObject(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* visualScene, const std::string& objectName, const char* skinId) const;
-	std::pair<char*, size_t> writeBoneNames(rapidxml::xml_document<>& doc, const Rig& rig) const;
-	std::pair<char*, size_t> writeBonePoses(rapidxml::xml_document<>& doc, const Rig& rig) const;
+	std::pair<char*, size_t> writeBoneNames(ConversionContext& context, const Rig& rig) const;
+	std::pair<char*, size_t> writeBonePoses(ConversionContext& context, const Rig& rig) const;
 	size_t computeVertexWeights(const Material& material, std::vector<float>& weightData, std::vector<size_t>& indexData) const;
 
+	struct SkinVertex {
+		glm::vec3 position;
+		float weight;		//second bone has 1 - weight
+		uint32_t matrix0;	//index into the skin matrices of the lod
+		uint32_t matrix1;
+	};
+	void bakeLod(const Lod& lod, const std::vector<glm::mat4>& poses, uint32_t frameCount, std::vector<float>& result) const;
+
 	const Skeleton& skeleton;
 };
\ No newline at end of file
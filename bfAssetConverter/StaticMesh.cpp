@@ -1,12 +1,14 @@
 #include "StaticMesh.h"
+#include "Trace.h"
 #include <string>
 
 using namespace Utils;
 using namespace rapidxml;
 
-StaticMesh::StaticMesh(std::istream& stream)
-	:Mesh(stream)
+StaticMesh::StaticMesh(std::istream& stream, bool streamBuffers)
+	:Mesh(stream, streamBuffers)
 {
+	Trace::Span span{ "StaticMesh::StaticMesh" };
 	stream.ignore(4);
 
 	//Lod data
@@ -19,9 +21,8 @@ StaticMesh::StaticMesh(std::istream& stream)
 	//Triangles
 	for (Geometry& geom : geometrys) {
 		for (Lod& lod : geom.lods) {
-			uint32_t materialCount;
-			readBinary(stream, &materialCount);
-			lod.materials.resize(materialCount);
+			uint32_t materialCount = readCount(stream, minMaterialBytes);
+			lod.materials = arena.allocateArray<Material>(materialCount);
 			for (Material& material : lod.materials) {
 				readBinary(stream, &material.alphamode);
 				readMaterial(stream, material);
@@ -33,8 +34,10 @@ StaticMesh::StaticMesh(std::istream& stream)
 	mirrorFix();
 }
 
-void StaticMesh::writeToCollada(xml_document<>& doc, xml_node<>* root, const Lod& lod) const
+void StaticMesh::writeToCollada(ConversionContext& context, xml_node<>* root, const Lod& lod) const
 {
+	Trace::Span span{ "StaticMesh::writeToCollada" };
+	xml_document<>& doc = context.document();
 	xml_node<>* libraryGeometries = root->first_node("library_geometries");
 	xml_node<>* libraryControllers = root->first_node("library_controllers");
 	xml_node<>* visualScene = root->first_node("library_visual_scenes")->first_node("visual_scene");
@@ -46,7 +49,7 @@ void StaticMesh::writeToCollada(xml_document<>& doc, xml_node<>* root, const Lod
 	for (size_t iMaterial = 0; iMaterial < lod.materials.size(); ++iMaterial) {
 		const Material& material = lod.materials[iMaterial];
 		std::string objectName = "Object_" + std::to_string(objectId);
-		char* meshId = writeGeometry(doc, libraryGeometries, objectName, material);
+		char* meshId = writeSharedGeometry(context, libraryGeometries, objectName, material);
 
 		xml_node<>* effect = doc.allocate_node(node_element, "effect");
 		char* effectId = Utils::setId(doc, effect, objectName + "-effect");
@@ -86,15 +89,14 @@ void StaticMesh::readLodNodeTable(std::istream& stream, Lod& lod)
 	if (version <= 6)
 		readBinary(stream, &lod.pivot);
 
-	uint32_t nodenum;
-	readBinary(stream, &nodenum);
-	lod.nodes.resize(nodenum);
+	uint32_t nodenum = readCount(stream, sizeof(glm::mat4));
+	lod.nodes = arena.allocateArray<glm::mat4>(nodenum);
 	for (glm::mat4& node : lod.nodes) {
 		readBinary(stream, &node);
 	}
 }
 
-void StaticMesh::readMaterial(std::istream& stream, Material& material) const
+void StaticMesh::readMaterial(std::istream& stream, Material& material)
 {
 	Mesh::readMaterial(stream, material);
 
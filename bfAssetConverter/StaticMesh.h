@@ -4,13 +4,13 @@
 class StaticMesh : public Mesh
 {
 public:
-	StaticMesh(std::istream& stream);
+	StaticMesh(std::istream& stream, bool streamBuffers = false);
 	~StaticMesh() = default;
 
 protected:
 	void readLodNodeTable(std::istream& stream, Lod& lod);
-	void readMaterial(std::istream& stream, Material& material) const override;
+	void readMaterial(std::istream& stream, Material& material) override;
 
-	void writeToCollada(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* root, const Lod& lod) const override;
+	void writeToCollada(ConversionContext& context, rapidxml::xml_node<>* root, const Lod& lod) const override;
 	void writeSceneObject(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* visualScene, const std::string& objectName, const char* geomId, const char* materialId) const;
 };
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "Trace.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+namespace {
+	struct Event {
+		const char* name;
+		std::string detail;
+		int64_t begin;
+		int64_t end;
+	};
+
+	// Only written by its own thread, read by write after the thread is done
+	struct ThreadEvents {
+		unsigned id;
+		std::string name;
+		std::vector<Event> events;
+	};
+
+	std::mutex threadsMutex;
+	std::vector<std::unique_ptr<ThreadEvents>> threads;
+	std::chrono::steady_clock::time_point origin;
+
+	ThreadEvents& threadEvents()
+	{
+		thread_local ThreadEvents* events = nullptr;
+		if (!events) {
+			std::lock_guard<std::mutex> lock{ threadsMutex };
+			threads.push_back(std::make_unique<ThreadEvents>());
+			events = threads.back().get();
+			events->id = unsigned(threads.size());
+		}
+		return *events;
+	}
+}
+
+namespace Trace {
+	namespace Detail {
+		std::atomic<bool> enabled{ false };
+
+		int64_t now()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+		}
+
+		void record(const char* name, const std::string* detail, int64_t begin, int64_t end)
+		{
+			threadEvents().events.push_back(Event{ name, detail ? *detail : std::string(), begin, end });
+		}
+	}
+
+	void start()
+	{
+		origin = std::chrono::steady_clock::now();
+		Detail::enabled = true;
+	}
+
+	void setThreadName(const char* name)
+	{
+		if (enabled())
+			threadEvents().name = name;
+	}
+
+	void write(std::ostream& stream)
+	{
+		rapidjson::StringBuffer json;
+		rapidjson::Writer<rapidjson::StringBuffer> writer{ json };
+		writer.StartObject();
+		writer.Key("displayTimeUnit");
+		writer.String("ms");
+		writer.Key("traceEvents");
+		writer.StartArray();
+		std::lock_guard<std::mutex> lock{ threadsMutex };
+		for (const std::unique_ptr<ThreadEvents>& thread : threads) {
+			if (!thread->name.empty()) {
+				writer.StartObject();
+				writer.Key("name"); writer.String("thread_name");
+				writer.Key("ph"); writer.String("M");
+				writer.Key("pid"); writer.Uint(1);
+				writer.Key("tid"); writer.Uint(thread->id);
+				writer.Key("args");
+				writer.StartObject();
+				writer.Key("name"); writer.String(thread->name.c_str());
+				writer.EndObject();
+				writer.EndObject();
+			}
+			//Complete events, timestamps in microseconds
+			for (const Event& event : thread->events) {
+				writer.StartObject();
+				writer.Key("name"); writer.String(event.name);
+				writer.Key("ph"); writer.String("X");
+				writer.Key("ts"); writer.Double(event.begin / 1000.0);
+				writer.Key("dur"); writer.Double((event.end - event.begin) / 1000.0);
+				writer.Key("pid"); writer.Uint(1);
+				writer.Key("tid"); writer.Uint(thread->id);
+				if (!event.detail.empty()) {
+					writer.Key("args");
+					writer.StartObject();
+					writer.Key("detail"); writer.String(event.detail.c_str());
+					writer.EndObject();
+				}
+				writer.EndObject();
+			}
+		}
+		writer.EndArray();
+		writer.EndObject();
+		stream.write(json.GetString(), json.GetSize());
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <ostream>
+#include <atomic>
+#include <cstdint>
+
+// Timeline of scoped spans per thread in Chrome trace event format, viewable in chrome://tracing or Perfetto.
+// Tracing is off until start is called, a Span then only costs one relaxed atomic load
+namespace Trace {
+	namespace Detail {
+		extern std::atomic<bool> enabled;
+		int64_t now();
+		void record(const char* name, const std::string* detail, int64_t begin, int64_t end);
+	}
+
+	inline bool enabled() { return Detail::enabled.load(std::memory_order_relaxed); }
+	// Starts recording, the timestamps of the trace are relative to this call
+	void start();
+	// Shown as the name of the calling thread's row
+	void setThreadName(const char* name);
+	// Writes every recorded span as JSON, threads that still record spans must not run at the same time
+	void write(std::ostream& stream);
+
+	// Records the time from its construction to its destruction on the calling thread.
+	// name must be a literal, detail (e.g. a file name) has to outlive the span
+	class Span
+	{
+	public:
+		explicit Span(const char* name, const std::string* detail = nullptr)
+			:name(name), detail(detail), begin(enabled() ? Detail::now() : -1) {}
+		~Span()
+		{
+			if (begin >= 0)
+				Detail::record(name, detail, begin, Detail::now());
+		}
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+
+	private:
+		const char* name;
+		const std::string* detail;
+		int64_t begin;
+	};
+}
@@ -1,5 +1,8 @@
 #include "Utils.h"
+#include <cstdio>
 #include <sstream>
+#include "ConversionContext.h"
+#include "Trace.h"
 #include <glm/gtc/matrix_transform.hpp>
 
 using namespace rapidxml;
@@ -8,18 +11,38 @@ std::string Utils::readStringFormat1(std::istream & stream)
 {
 	uint16_t length;
 	readBinary(stream, &length);
-	std::vector<char> buffer(length);
-	readBinaryArray(stream, buffer.data(), buffer.size());
-	return std::string(buffer.data(), buffer.size()-1);
+	std::string result(length, '\0');
+	readBinaryArray(stream, &result[0], length);
+	if (!result.empty())
+		result.pop_back();	//length includes the terminator
+	return result;
 }
 
 std::string Utils::readStringFormat2(std::istream& stream)
 {
 	uint32_t strLength;
 	readBinary(stream, &strLength);
-	std::vector<char> buffer(strLength);
-	readBinaryArray(stream, buffer.data(), buffer.size());
-	return std::string(buffer.data(), buffer.size());
+	std::string result(strLength, '\0');
+	readBinaryArray(stream, &result[0], strLength);
+	return result;
+}
+
+StringRef Utils::readStringFormat1(std::istream& stream, Arena& arena)
+{
+	uint16_t length;
+	readBinary(stream, &length);
+	char* data = static_cast<char*>(arena.allocate(length, 1));
+	readBinaryArray(stream, data, length);
+	return StringRef{ data, length ? size_t(length - 1) : 0 };
+}
+
+StringRef Utils::readStringFormat2(std::istream& stream, Arena& arena)
+{
+	uint32_t strLength;
+	readBinary(stream, &strLength);
+	char* data = static_cast<char*>(arena.allocate(strLength, 1));
+	readBinaryArray(stream, data, strLength);
+	return StringRef{ data, strLength };
 }
 
 float Utils::fixedToFloat(int16_t value, uint8_t precision)
@@ -28,48 +51,66 @@ float Utils::fixedToFloat(int16_t value, uint8_t precision)
 	return value * multiplicator;
 }
 
-void Utils::writeMatrixToStream(std::ostream& stream, const glm::mat4& mat)
+void Utils::appendFloat(std::string& text, float value)
+{
+	char buffer[32];
+	int length = std::snprintf(buffer, sizeof(buffer), "%g", value);
+	text.append(buffer, length);
+	text.push_back(' ');
+}
+
+void Utils::appendIndex(std::string& text, size_t value)
+{
+	char buffer[32];
+	int length = std::snprintf(buffer, sizeof(buffer), "%zu", value);
+	text.append(buffer, length);
+	text.push_back(' ');
+}
+
+void Utils::appendMatrix(std::string& text, const glm::mat4& mat)
 {
 	for (int k = 0; k < 4; ++k) {
 		for (int l = 0; l < 4; ++l) {
-			stream << mat[l][k] << " ";	//column major -> row major
+			appendFloat(text, mat[l][k]);	//column major -> row major
 		}
 	}
 }
 
-char* Utils::matrixToString(rapidxml::xml_document<>& doc, const glm::mat4& mat)
+char* Utils::allocateText(rapidxml::xml_document<>& doc, std::string& text)
+{
+	if (!text.empty())
+		text.pop_back();
+	return doc.allocate_string(text.c_str(), text.length() + 1);
+}
+
+char* Utils::matrixToString(ConversionContext& context, const glm::mat4& mat)
 {
-	std::stringstream ss;
-	writeMatrixToStream(ss, mat);
-	std::string dataString = ss.str();
-	dataString.pop_back();
-	return doc.allocate_string(dataString.c_str(), dataString.length() + 1);
+	std::string& text = context.text();
+	appendMatrix(text, mat);
+	return allocateText(context.document(), text);
 }
 
-char* Utils::floatsToString(rapidxml::xml_document<>& doc, const std::vector<float>& data)
+char* Utils::floatsToString(ConversionContext& context, const std::vector<float>& data)
 {
-	std::stringstream ss;
+	std::string& text = context.text();
 	for (const float f : data) {
-		ss << f << " ";
+		appendFloat(text, f);
 	}
-	std::string dataString = ss.str();
-	dataString.pop_back();
-	return doc.allocate_string(dataString.c_str(), dataString.length() + 1);
+	return allocateText(context.document(), text);
 }
 
-char* Utils::indicesToString(rapidxml::xml_document<>& doc, const std::vector<size_t>& data)
+char* Utils::indicesToString(ConversionContext& context, const std::vector<size_t>& data)
 {
-	std::stringstream ss;
+	std::string& text = context.text();
 	for (const size_t index : data) {
-		ss << index << " ";
+		appendIndex(text, index);
 	}
-	std::string dataString = ss.str();
-	dataString.pop_back();
-	return doc.allocate_string(dataString.c_str(), dataString.length() + 1);
+	return allocateText(context.document(), text);
 }
 
 char* Utils::writeSourceNode(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* parent, const std::string& id, const char* dataString, size_t elemCount, Format format)
 {
+	Trace::Span span{ "writeSourceNode" };
 	using namespace rapidxml;
 	xml_node<>* source = doc.allocate_node(node_element, "source");
 	char *resultId = setId(doc, source, id);
@@ -238,3 +279,46 @@ rapidxml::xml_node<>* Utils::createColladaFramework(rapidxml::xml_document<>& do
 
 	return root;
 }
+
+Utils::MemoryBuffer::MemoryBuffer(const char* data, size_t size)
+{
+	char* begin = const_cast<char*>(data);
+	setg(begin, begin, begin + size);
+}
+
+Utils::MemoryBuffer::pos_type Utils::MemoryBuffer::seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+	if (!(which & std::ios_base::in))
+		return pos_type(off_type(-1));
+
+	off_type base = 0;
+	if (dir == std::ios_base::cur)
+		base = gptr() - eback();
+	else if (dir == std::ios_base::end)
+		base = egptr() - eback();
+	off_type target = base + offset;
+	if (target < 0 || target > egptr() - eback())
+		return pos_type(off_type(-1));
+
+	setg(eback(), eback() + target, egptr());
+	return pos_type(target);
+}
+
+namespace {
+	thread_local unsigned parallelThreadCount = 0;
+}
+
+void Utils::setParallelThreads(unsigned count)
+{
+	parallelThreadCount = count;
+}
+
+unsigned Utils::parallelThreads()
+{
+	return parallelThreadCount ? parallelThreadCount : std::max(1u, std::thread::hardware_concurrency());
+}
+
+Utils::MemoryBuffer::pos_type Utils::MemoryBuffer::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+	return seekoff(off_type(pos), std::ios_base::beg, which);
+}
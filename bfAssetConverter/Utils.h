@@ -1,9 +1,17 @@
 #pragma once
 #include <istream>
+#include <streambuf>
+#include <ostream>
 #include <vector>
+#include <thread>
+#include <algorithm>
+#include <exception>
 #include <glm/vec3.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <rapidxml/rapidxml.hpp>
+#include "Arena.h"
+
+class ConversionContext;
 
 namespace Utils {
 	class ConversionError :public std::runtime_error {
@@ -22,14 +30,31 @@ namespace Utils {
 		if(elementCount)
 			stream.read(reinterpret_cast<char*>(result), sizeof(T) * elementCount);
 	}
+	template<typename T> void writeBinary(std::ostream& stream, const T& value)
+	{
+		stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+	template<typename T> void writeBinaryArray(std::ostream& stream, const T* data, size_t elementCount)
+	{
+		if (elementCount)
+			stream.write(reinterpret_cast<const char*>(data), sizeof(T) * elementCount);
+	}
 	std::string readStringFormat1(std::istream& stream);
 	std::string readStringFormat2(std::istream& stream);
+	// Same formats, the characters are stored in arena
+	StringRef readStringFormat1(std::istream& stream, Arena& arena);
+	StringRef readStringFormat2(std::istream& stream, Arena& arena);
 
 	float fixedToFloat(int16_t value, uint8_t precision = 15);
-	void writeMatrixToStream(std::ostream& stream, const glm::mat4& mat);
-	char* matrixToString(rapidxml::xml_document<>& doc, const glm::mat4& mat);
-	char* floatsToString(rapidxml::xml_document<>& doc, const std::vector<float>& data);
-	char* indicesToString(rapidxml::xml_document<>& doc, const std::vector<size_t>& data);
+	// Append a value and a separator, formatted like std::ostream does by default
+	void appendFloat(std::string& text, float value);
+	void appendIndex(std::string& text, size_t value);
+	void appendMatrix(std::string& text, const glm::mat4& mat);
+	// Copies text without its trailing separator into doc
+	char* allocateText(rapidxml::xml_document<>& doc, std::string& text);
+	char* matrixToString(ConversionContext& context, const glm::mat4& mat);
+	char* floatsToString(ConversionContext& context, const std::vector<float>& data);
+	char* indicesToString(ConversionContext& context, const std::vector<size_t>& data);
 	enum class Format { xyz, st, weight, transform, joint, time, interpolation };
 	char* writeSourceNode(rapidxml::xml_document<>& doc, rapidxml::xml_node<> *parent, const std::string& id, const char* dataString, size_t elemCount, Format format);
 
@@ -37,4 +62,56 @@ namespace Utils {
 	char* setId(rapidxml::xml_document<>& doc, rapidxml::xml_node<>* node, const std::string& id);
 
 	rapidxml::xml_node<>* createColladaFramework(rapidxml::xml_document<>& doc);
+
+	// Read only stream buffer over memory owned by the caller, the data is not copied
+	class MemoryBuffer :public std::streambuf {
+	public:
+		MemoryBuffer(const char* data, size_t size);
+
+	protected:
+		pos_type seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+	};
+
+	// Number of threads parallelFor uses on the calling thread, 0 (default) uses one per hardware thread.
+	// Threads that run next to each other, e.g. pipeline workers, share the hardware threads through it
+	void setParallelThreads(unsigned count);
+	unsigned parallelThreads();
+
+	// Splits [0, count) into one contiguous range per thread of parallelThreads and calls func(begin, end) for each range,
+	// with one thread the ranges run on the calling thread.
+	// The first exception thrown by any range is rethrown after all threads have finished.
+	template<typename Func> void parallelFor(size_t count, Func func)
+	{
+		size_t threadCount = std::min<size_t>(parallelThreads(), count);
+		if (threadCount <= 1) {
+			if (count)
+				func(size_t(0), count);
+			return;
+		}
+
+		std::vector<std::thread> threads;
+		std::vector<std::exception_ptr> errors(threadCount);
+		size_t chunk = (count + threadCount - 1) / threadCount;
+		for (size_t t = 0; t < threadCount; ++t) {
+			size_t begin = t * chunk;
+			size_t end = std::min(begin + chunk, count);
+			threads.emplace_back([&func, &errors, t, begin, end]() {
+				try {
+					if (begin < end)
+						func(begin, end);
+				}
+				catch (...) {
+					errors[t] = std::current_exception();
+				}
+			});
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		for (const std::exception_ptr& error : errors) {
+			if (error)
+				std::rethrow_exception(error);
+		}
+	}
 }
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+
+// Float offsets of the vertex attributes the converter reads, and the vertex stride in floats.
+// An attribute is missing if the mesh does not have it or stores it with another vartype
+struct VertexLayout {
+	static constexpr uint32_t missing = 0xFFFFFFFF;
+
+	uint32_t stride;
+	uint32_t position;		//float3
+	uint32_t normal;		//float3
+	uint32_t uv1;			//float2
+	uint32_t blendWeight;	//float1
+	uint32_t blendIndices;	//d3dcolor
+};
+
+// A VertexLayout known at compile time, vertex loops get constant strides and offsets and can be unrolled and vectorized
+template<uint32_t Stride, uint32_t Position, uint32_t Normal, uint32_t Uv1,
+	uint32_t BlendWeight = VertexLayout::missing, uint32_t BlendIndices = VertexLayout::missing>
+struct FixedVertexLayout {
+	static constexpr uint32_t stride = Stride;
+	static constexpr uint32_t position = Position;
+	static constexpr uint32_t normal = Normal;
+	static constexpr uint32_t uv1 = Uv1;
+	static constexpr uint32_t blendWeight = BlendWeight;
+	static constexpr uint32_t blendIndices = BlendIndices;
+
+	static bool matches(const VertexLayout& layout)
+	{
+		return layout.stride == stride && layout.position == position && layout.normal == normal && layout.uv1 == uv1
+			&& layout.blendWeight == blendWeight && layout.blendIndices == blendIndices;
+	}
+};
+
+// Layouts of the shipped BF Heroes assets
+typedef FixedVertexLayout<16, 0, 3, 7, VertexLayout::missing, 6> StaticMeshLayout;	//+ uv2, uv3 and tangent
+typedef FixedVertexLayout<12, 0, 3, 7, VertexLayout::missing, 6> BundledMeshLayout;	//+ tangent
+typedef FixedVertexLayout<13, 0, 3, 8, 6, 7> SkinnedMeshLayout;	//+ tangent
+
+// Calls func once with the matching FixedVertexLayout, or with layout itself if it is none of the known ones.
+// func is a generic lambda that reads the layout members the same way for both
+template<typename Func> void dispatchVertexLayout(const VertexLayout& layout, Func func)
+{
+	if (StaticMeshLayout::matches(layout))
+		func(StaticMeshLayout{});
+	else if (BundledMeshLayout::matches(layout))
+		func(BundledMeshLayout{});
+	else if (SkinnedMeshLayout::matches(layout))
+		func(SkinnedMeshLayout{});
+	else
+		func(layout);
+}
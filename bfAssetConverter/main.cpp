@@ -1,29 +1,71 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
-#include <rapidxml/rapidxml_print.hpp>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 #include <tclap/CmdLine.h>
 #include "Utils.h"
-#include "Animation.h"
-#include "SkinnedMesh.h"
-#include "BundledMesh.h"
-#include "StaticMesh.h"
-#include "CollisionMesh.h"
-
-std::string getExtension(const std::string& filename);
-std::string defaultOutputFile(const std::string& filename);
-void convertFile(std::istream& input, const std::string& output, const std::string& extension, const Skeleton* skeleton);
+#include "Converter.h"
+#include "Daemon.h"
+#include "Pipeline.h"
+#include "Compression.h"
+#include "GeometryStore.h"
+#include "Trace.h"
 
 int main(int argc, char** argv)
 {
 	try {
 		TCLAP::CmdLine cmd{ "Converts Battlefield assets to common formats", ' ', "1.0" };
 		TCLAP::ValueArg<std::string> skeletonArg{ "s", "skeleton", "Skeleton file (.ske)", false, "", "filename", cmd };
-		TCLAP::UnlabeledMultiArg<std::string> fileArgs{ "filenames", "Files to convert", true, "filename", cmd };
+		TCLAP::UnlabeledMultiArg<std::string> fileArgs{ "filenames", "Files to convert", false, "filename", cmd };
 		TCLAP::MultiArg<std::string> outputArgs{ "o", "output", "Basename of output files (same order as input files)", false, "path/base", cmd };
+		std::vector<std::string> formats{ "dae", "poses", "clip", "vcache", "accel", "npz" };
+		TCLAP::ValuesConstraint<std::string> formatConstraint{ formats };
+		TCLAP::ValueArg<std::string> formatArg{ "f", "format", "Output format", false, "dae", &formatConstraint, cmd };
+		TCLAP::MultiArg<std::string> animationArgs{ "a", "animation", "Animation (.baf) to bake into the vertex caches of skinnedmeshes", false, "filename", cmd };
+		std::vector<std::string> sinks{ "file", "tar", "stdout" };
+		TCLAP::ValuesConstraint<std::string> sinkConstraint{ sinks };
+		TCLAP::ValueArg<std::string> sinkArg{ "", "sink", "Destination of the outputs", false, "file", &sinkConstraint, cmd };
+		TCLAP::ValueArg<std::string> archiveArg{ "", "archive", "Archive written with --sink tar, - for stdout", false, "-", "filename", cmd };
+		std::vector<std::string> ioBackends{ "blocking", "uring" };
+		TCLAP::ValuesConstraint<std::string> ioConstraint{ ioBackends };
+		TCLAP::ValueArg<std::string> ioArg{ "", "io", "File I/O backend, uring (Linux only) submits batches of reads and writes", false, "blocking", &ioConstraint, cmd };
+		TCLAP::ValueArg<unsigned> jobsArg{ "j", "jobs", "Number of files converted in parallel", false, 1, "count", cmd };
+		std::vector<std::string> compressions{ "none", "gzip", "zstd" };
+		TCLAP::ValuesConstraint<std::string> compressConstraint{ compressions };
+		TCLAP::ValueArg<std::string> compressArg{ "", "compress", "Compress every output on a fixed set of compression threads, appends .gz or .zst", false, "none", &compressConstraint, cmd };
+		TCLAP::ValueArg<int> compressLevelArg{ "", "compress-level", "Compression level, 0 selects the default of the method", false, 0, "level", cmd };
+		TCLAP::SwitchArg streamArg{ "", "stream", "Convert static and bundled meshes one material at a time straight from the input file", cmd };
+		TCLAP::ValueArg<std::string> geometryStoreArg{ "", "geometry-store", "Folder in which identical geometries of static and bundled meshes are stored once", false, "", "folder", cmd };
+		TCLAP::ValueArg<std::string> traceArg{ "", "trace", "Records a timeline of every file and conversion stage per thread in Chrome trace format (chrome://tracing, Perfetto)", false, "", "file.json", cmd };
+		TCLAP::SwitchArg daemonArg{ "d", "daemon", "Read conversion jobs as JSON lines from stdin and answer on stdout", cmd };
+		TCLAP::ValueArg<unsigned> cacheArg{ "", "cache-mb", "Memory budget in MB for cached conversion results in daemon mode", false, 256, "MB", cmd };
 		
 		cmd.parse(argc, argv);
 
+		//The spans of a daemon would grow for its whole lifetime and it never ends the conversion to write them
+		if (traceArg.isSet() && daemonArg.getValue())
+			throw std::runtime_error("--trace can not be used in daemon mode");
+
+		//Opened first so a bad path fails before the conversion
+		std::ofstream traceFile;
+		if (traceArg.isSet()) {
+			traceFile.open(traceArg.getValue(), std::ofstream::out | std::ofstream::binary);
+			if (!traceFile.good())
+				throw std::runtime_error("Can not write to trace file " + traceArg.getValue());
+			Trace::start();
+			Trace::setThreadName("main");
+		}
+
+		if (daemonArg.getValue()) {
+			runDaemon(std::cin, std::cout, size_t(cacheArg.getValue()) * 1024 * 1024);
+			return 0;
+		}
+		if (fileArgs.getValue().empty())
+			throw std::runtime_error("No files to convert");
+
 		std::unique_ptr<Skeleton> skeleton;
 		if (skeletonArg.isSet()) {
 			std::ifstream skeletonFile{ skeletonArg.getValue(), std::ifstream::in | std::ifstream::binary };
@@ -31,24 +73,94 @@ int main(int argc, char** argv)
 				throw std::runtime_error("Could not open skeleton file " + skeletonArg.getValue());
 			skeleton = std::make_unique<Skeleton>(skeletonFile);
 		}
+
+		AnimationList animations;
+		for (const std::string& animationName : animationArgs.getValue()) {
+			if (!skeleton)
+				throw std::runtime_error("Animations require a skeleton file");
+			std::ifstream animationFile{ animationName, std::ifstream::in | std::ifstream::binary };
+			if (!animationFile.good())
+				throw std::runtime_error("Could not open animation file " + animationName);
+			animations.emplace_back(baseName(animationName), std::make_shared<Animation>(animationFile, *skeleton));
+		}
 		
+		//Outputs streamed to stdout must not be mixed with log messages or newline conversion
+		bool useStdout = sinkArg.getValue() == "stdout" || (sinkArg.getValue() == "tar" && archiveArg.getValue() == "-");
+		std::ostream& log = useStdout ? std::cerr : std::cout;
+		if (useStdout) {
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		}
+
+		//Reader and writer run on different threads, each gets its own backend
+		std::unique_ptr<FileIo> readIo = createFileIo(ioArg.getValue());
+		std::unique_ptr<FileIo> writeIo = createFileIo(ioArg.getValue());
+		std::ofstream archiveFile;
+		std::unique_ptr<OutputSink> sink;
+		if (sinkArg.getValue() == "tar") {
+			if (!useStdout) {
+				archiveFile.open(archiveArg.getValue(), std::ofstream::out | std::ofstream::binary);
+				if (!archiveFile.good())
+					throw std::runtime_error("Can not write to archive " + archiveArg.getValue());
+			}
+			sink = std::make_unique<TarSink>(useStdout ? std::cout : archiveFile);
+		}
+		else if (sinkArg.getValue() == "stdout") {
+			sink = std::make_unique<StreamSink>(std::cout);
+		}
+		else {
+			sink = std::make_unique<FileSink>(*writeIo);
+		}
+
+		std::vector<ConversionJob> jobs;
 		for (size_t i = 0; i < fileArgs.getValue().size(); ++i) {
 			std::string inputName = fileArgs.getValue()[i];
 			bool outputSpecified = i < outputArgs.getValue().size();
-			std::string outputName = outputSpecified ? outputArgs.getValue()[i] : defaultOutputFile(inputName);
-
-			try {
-				std::ifstream inputFile{ inputName, std::ifstream::in | std::ifstream::binary };
-				if (!inputFile.good())
-					throw Utils::ConversionError("Could not open input");
+			jobs.push_back(ConversionJob{ inputName, outputSpecified ? outputArgs.getValue()[i] : defaultOutputFile(inputName) });
+		}
+		//In streaming mode inputs are read while the outputs are written, so file outputs are written directly instead of through the I/O backend
+		FileSink directSink;
+		OutputSink& targetSink = streamArg.getValue() && sinkArg.getValue() == "file" ? directSink : *sink;
+		std::unique_ptr<CompressingSink> compressingSink;
+		if (compressArg.getValue() != "none")
+			compressingSink = std::make_unique<CompressingSink>(targetSink, compressArg.getValue(), compressLevelArg.getValue());
+		OutputSink& outputSink = compressingSink ? *compressingSink : targetSink;
+		//The urls of the stored geometries name the compressed files
+		std::unique_ptr<GeometryStore> geometryStore;
+		if (geometryStoreArg.isSet())
+			geometryStore = std::make_unique<GeometryStore>(geometryStoreArg.getValue(), compressingSink ? compressingSink->getExtension() : "");
 
-				std::cout << "Converting " << inputName << std::endl;
-				convertFile(inputFile, outputName, getExtension(inputName), skeleton.get());
-			}
-			catch (Utils::ConversionError& e) {
-				std::cerr << "Error at file " << inputName << ": " << e.what() << std::endl;
+		if (streamArg.getValue()) {
+			//Files are converted one after another without the pipeline
+			ConversionContext context;
+			context.geometryStore = geometryStore.get();
+			for (const ConversionJob& job : jobs) {
+				log << "Converting " << job.input << std::endl;
+				Trace::Span span{ "convert", &job.input };
+				try {
+					std::ifstream input{ job.input, std::ifstream::in | std::ifstream::binary };
+					if (!input.good())
+						throw Utils::ConversionError("Could not open input");
+					convertFile(input, job.output, getExtension(job.input), formatArg.getValue(), skeleton.get(), animations, outputSink, context, true);
+					if (geometryStore)
+						geometryStore->commit(context.geometryReferences, context.geometryFiles);
+				}
+				catch (Utils::ConversionError& e) {
+					std::cerr << "Error at file " << job.input << ": " << e.what() << std::endl;
+				}
 			}
 		}
+		else {
+			runPipeline(jobs, formatArg.getValue(), skeleton.get(), animations, outputSink, *readIo, jobsArg.getValue(), log, std::cerr, geometryStore.get());
+		}
+		if (geometryStore)
+			geometryStore->writeReport(log);
+		if (traceFile.is_open())
+			Trace::write(traceFile);
+
+		if (TarSink* tar = dynamic_cast<TarSink*>(sink.get()))
+			tar->finish();
 	}
 	catch (TCLAP::ArgException& e) {
 		std::cerr << "error: " << e.error() << " at arg " << e.argId() << std::endl;
@@ -61,55 +173,3 @@ int main(int argc, char** argv)
 
 	return 0;
 }
-
-std::string getExtension(const std::string& filename)
-{
-	size_t pos = filename.find_last_of('.');
-	if (pos == std::string::npos)
-		return "";
-	return filename.substr(pos + 1);
-}
-
-std::string defaultOutputFile(const std::string& filename)
-{
-	size_t pos = filename.find_last_of('.');
-	if (pos == std::string::npos)
-		pos = filename.length();
-	return filename.substr(0, pos);
-}
-
-void convertFile(std::istream& input, const std::string& output, const std::string& extension, const Skeleton* skeleton)
-{
-	auto doc = std::make_unique<rapidxml::xml_document<>>();
-	rapidxml::xml_node<>* root = Utils::createColladaFramework(*doc);
-
-	if(extension.compare("baf") == 0) {
-		if (!skeleton)
-			throw Utils::ConversionError("Animations require a skeleton file");
-		Animation anim{ input, *skeleton };
-		anim.writeToCollada(*doc, root);
-		std::ofstream outputFile{ output + ".dae" };
-		outputFile << *doc;
-	}
-	else if (extension.compare("skinnedmesh") == 0) {
-		if (!skeleton)
-			throw Utils::ConversionError("Skinnedmeshes require a skeleton file");
-		SkinnedMesh mesh{ input, *skeleton };
-		mesh.writeFiles(output);
-	}
-	else if (extension.compare("bundledmesh") == 0) {
-		BundledMesh mesh{ input };
-		mesh.writeFiles(output);
-	}
-	else if (extension.compare("staticmesh") == 0) {
-		StaticMesh mesh{ input };
-		mesh.writeFiles(output);
-	}
-	else if (extension.compare("collisionmesh") == 0) {
-		CollisionMesh mesh{ input };
-		mesh.writeFiles(output);
-	}
-	else {
-		throw Utils::ConversionError("Unsupported filetype " + extension);
-	}
-}